@@ -0,0 +1,126 @@
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <unistd.h>
+
+#include "CsvReader.h"
+#include "defs.h"
+
+
+/*
+ * Checks for the parallel csv reader at several thread counts: chunk
+ * boundaries, header detection, CRLF, blank lines and blanks around fields,
+ * and the file line numbers reported for malformed rows.
+ */
+
+static void check(bool condition, const std::string& message) {
+    if (not condition) {
+        throw std::runtime_error(message);
+    }
+}
+
+//more threads than lines included, so some chunks are empty or a single line
+static const std::vector<size_t> threadCounts{1, 2, 3, 4, 7, 16};
+
+static fs::path writeFile(const std::string& contents) {
+    static size_t count = 0;
+    const auto path = fs::temp_directory_path() / ("csv-reader-test-" + std::to_string(::getpid()) + "-" + std::to_string(count++) + ".csv");
+    if (std::ofstream file{path, std::ios::binary}) {
+        file << contents;
+    } else throw std::runtime_error("Could not create file " + path.string());
+    return path;
+}
+
+static std::pair<std::vector<double>, std::vector<double>> readColumns(const std::string& contents, size_t numThreads) {
+    const auto path = writeFile(contents);
+    std::vector<double> first, second;
+    try {
+        CsvReader<double>{path}.read({&first, &second}, numThreads);
+    }
+    catch (...) {
+        fs::remove(path);
+        throw;
+    }
+    fs::remove(path);
+    return {first, second};
+}
+
+static void expectColumns(const std::string& name, const std::string& contents, const std::vector<double>& first, const std::vector<double>& second) {
+    for (const size_t numThreads : threadCounts) {
+        const auto columns = readColumns(contents, numThreads);
+        check(columns.first == first and columns.second == second, name + ": wrong values with " + std::to_string(numThreads) + " threads");
+    }
+    std::cout << name << ": ok\n";
+}
+
+//the reader has to fail and name the given line of the file
+static void expectError(const std::string& name, const std::string& contents, size_t line) {
+    for (const size_t numThreads : threadCounts) {
+        std::string message;
+        try {
+            readColumns(contents, numThreads);
+        }
+        catch (std::invalid_argument& e) {
+            message = e.what();
+        }
+        check(not message.empty(), name + ": no error with " + std::to_string(numThreads) + " threads");
+        check(message.find("line " + std::to_string(line) + " ") != std::string::npos, name + ": expected line " + std::to_string(line) + " with " + std::to_string(numThreads) + " threads, got: " + message);
+    }
+    std::cout << name << ": ok\n";
+}
+
+static void testChunks() {
+    std::string contents = "timestamp,price\n";
+    std::vector<double> first, second;
+    for (size_t i = 0; i < 1000; ++i) {
+        first.push_back(static_cast<double>(i));
+        second.push_back(static_cast<double>(i) * 0.5);
+        contents += std::to_string(i) + "," + std::to_string(static_cast<double>(i) * 0.5) + "\n";
+    }
+    expectColumns("chunks", contents, first, second);
+    expectColumns("no trailing newline", "1,2\n3,4", {1, 3}, {2, 4});
+    expectColumns("empty file", "", {}, {});
+    expectColumns("header only", "p,s\n", {}, {});
+}
+
+static void testHeader() {
+    expectColumns("text header", "p,s\n1,2\n", {1}, {2});
+    expectColumns("numeric first line", "1,2\n3,4\n", {1, 3}, {2, 4});
+    //one numeric field makes the first line data, which then has to be well formed
+    expectError("partly numeric first line", "p,5\n1,2\n", 1);
+}
+
+static void testLineEndings() {
+    expectColumns("crlf", "p,s\r\n1,2\r\n3,4\r\n", {1, 3}, {2, 4});
+    expectColumns("blank lines", "\n1,2\n\n\r\n3,4\n\n", {1, 3}, {2, 4});
+    expectColumns("blanks around fields", "p, s\n1, 2\n 3 ,\t4 \n  \n5,6\t\r\n", {1, 3, 5}, {2, 4, 6});
+}
+
+static void testLineNumbers() {
+    expectError("too few columns", "p,s\n1,2\n3\n", 3);
+    expectError("too many columns", "1,2\n3,4\n5,6,7\n", 3);
+    expectError("not a number", "p,s\n\n1,2\n\n3,x\n", 5);
+    expectError("blank inside a number", "1,2\n3 4,5\n", 2);
+
+    //far enough into the file to be in a later chunk for every thread count above one
+    std::string contents = "p,s\n";
+    for (size_t i = 0; i < 500; ++i) {
+        contents += (i % 3 ? "1,2\n" : "\n");
+    }
+    contents += "1;2\n";
+    expectError("late malformed line", contents, 502);
+}
+
+int main() {
+    try {
+        testChunks();
+        testHeader();
+        testLineEndings();
+        testLineNumbers();
+    }
+    catch (std::exception& e) {
+        std::cerr << "FAILED: " << e.what() << '\n';
+        return 1;
+    }
+}
@@ -0,0 +1,291 @@
+#include <vector>
+#include <functional>
+#include <sys/wait.h>
+#include <arpa/inet.h>
+
+#include "Collective.h"
+#include "DataParallel.h"
+#include "Perceptron.h"
+#include "defs.h"
+
+
+/*
+ * Checks for the data-parallel training path that run with every worker on
+ * this machine: ring all-reduce over shared memory and tcp, batched gradients
+ * against the per-sample update, gradient bucketing, and full trainer steps
+ * across forked workers.
+ */
+
+static void check(bool condition, const std::string& message) {
+    if (not condition) {
+        throw std::runtime_error(message);
+    }
+}
+
+//runs fn(rank) in numWorkers forked processes and fails unless all of them succeed
+static void forkWorkers(size_t numWorkers, const std::function<void(size_t)>& fn) {
+    std::cout.flush();
+    std::fflush(nullptr);
+
+    std::vector<pid_t> children;
+    for (size_t rank = 0; rank < numWorkers; ++rank) {
+        const pid_t pid = ::fork();
+        check(pid >= 0, "Could not fork worker " + std::to_string(rank));
+        if (pid == 0) {
+            int status = 0;
+            try {
+                fn(rank);
+            }
+            catch (std::exception& e) {
+                std::cerr << "worker " << rank << ": " << e.what() << '\n';
+                status = 1;
+            }
+            std::cerr.flush();
+            ::_exit(status);
+        }
+        children.push_back(pid);
+    }
+
+    bool ok = true;
+    for (const pid_t child : children) {
+        int status;
+        ok &= ::waitpid(child, &status, 0) == child and WIFEXITED(status) and WEXITSTATUS(status) == 0;
+    }
+    check(ok, std::to_string(numWorkers) + " workers did not all succeed");
+}
+
+//value rank r contributes at index i; small integers, so the sums are exact
+static double contribution(size_t rank, size_t i) {
+    return static_cast<double>((rank + 1) * (i % 7 + 1));
+}
+
+static void checkSum(Transport& transport, size_t length) {
+    std::vector<double> data(length);
+    for (size_t i = 0; i < length; ++i) {
+        data[i] = contribution(transport.rank(), i);
+    }
+    ringAllReduce<double>(transport, data);
+
+    for (size_t i = 0; i < length; ++i) {
+        double expected = 0;
+        for (size_t r = 0; r < transport.size(); ++r) {
+            expected += contribution(r, i);
+        }
+        check(data[i] == expected, "Wrong sum at " + std::to_string(i) + " of " + std::to_string(length) + " values over " + std::to_string(transport.size()) + " ranks");
+    }
+}
+
+static const std::vector<size_t> lengths{1, 2, 3, 7, 1001, 4099, 300001};
+
+static void testShmAllReduce() {
+    for (const size_t numWorkers : {2, 3, 5}) {
+        ShmSegment segment{numWorkers, 4096}; //smaller than the larger messages, so the rings wrap
+        forkWorkers(numWorkers, [&](size_t rank) {
+            ShmTransport transport{segment, rank};
+            for (const size_t length : lengths) {
+                checkSum(transport, length);
+            }
+        });
+        std::cout << "shared memory all-reduce over " << numWorkers << " ranks: ok\n";
+    }
+}
+
+//ports the kernel considers free right now; closed again before the workers bind them
+static std::vector<std::string> localPeers(size_t count) {
+    std::vector<std::string> peers;
+    for (size_t i = 0; i < count; ++i) {
+        const int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t length = sizeof(address);
+        check(fd >= 0 and ::bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0
+              and ::getsockname(fd, reinterpret_cast<sockaddr*>(&address), &length) == 0, "Could not find a free port");
+        peers.push_back("127.0.0.1:" + std::to_string(ntohs(address.sin_port)));
+        ::close(fd);
+    }
+    return peers;
+}
+
+static void testSocketAllReduce() {
+    for (const size_t numWorkers : {2, 3}) {
+        const auto peers = localPeers(numWorkers);
+        forkWorkers(numWorkers, [&](size_t rank) {
+            SocketTransport transport{rank, peers};
+            for (const size_t length : lengths) {
+                checkSum(transport, length);
+            }
+        });
+        std::cout << "tcp all-reduce over " << numWorkers << " ranks: ok\n";
+    }
+}
+
+static void testBroadcast() {
+    ShmSegment segment{3};
+    forkWorkers(3, [&](size_t rank) {
+        ShmTransport transport{segment, rank};
+        uint64_t values[3] = {rank, 1000 + rank, rank * rank};
+        ringBroadcast(transport, std::as_writable_bytes(std::span{values}));
+        check(values[0] == 0 and values[1] == 1000 and values[2] == 0, "Rank " + std::to_string(rank) + " did not receive rank 0's values");
+    });
+    std::cout << "broadcast: ok\n";
+}
+
+static Perceptron<double> makeModel(const json& description) {
+    const auto path = fs::temp_directory_path() / ("data-parallel-test-" + std::to_string(::getpid()) + ".json");
+    if (std::ofstream file{path}) {
+        file << description;
+    } else throw std::runtime_error("Could not create file " + path.string());
+    auto model = Perceptron<double>::newFromJson(path);
+    fs::remove(path);
+    return model;
+}
+
+static const json smallModel = {
+        {"inputs", 12},
+        {"layers", {
+                {{"activation", "tanh"}, {"size", 8}},
+                {{"activation", "sigmoid"}, {"size", 5}},
+                {{"activation", "relu"}, {"size", 4}},
+                {{"activation", "none"}, {"size", 2}}
+        }}
+};
+
+static double maxDifference(const Perceptron<double>::Snapshot& a, const Perceptron<double>::Snapshot& b) {
+    double difference = 0;
+    for (size_t l = 0; l < a.weights.size(); ++l) {
+        difference = std::max(difference, (a.weights[l] - b.weights[l]).cwiseAbs().maxCoeff());
+        difference = std::max(difference, (a.biases[l] - b.biases[l]).cwiseAbs().maxCoeff());
+    }
+    return difference;
+}
+
+/*
+ * updateWeights already uses a layer's updated weights to propagate the error
+ * to the layer below, so the two only agree up to a term of order
+ * learningRate^2; with a tiny learning rate the scaled updates must match
+ * closely.
+ */
+static void testGradients() {
+    const auto base = makeModel(smallModel);
+    const double learningRate = 1e-7;
+    const MatrixX<double> inputs = MatrixX<double>::Random(12, 4), targets = MatrixX<double>::Random(2, 4);
+
+    Perceptron<double>::Snapshot batched, perSample;
+
+    Perceptron<double>::Gradients gradients;
+    for (Index j = 0; j < inputs.cols(); ++j) {
+        auto reference = base;
+        reference.updateWeights(VectorX<double>(inputs.col(j)), VectorX<double>(targets.col(j)), learningRate);
+        reference.snapshot(perSample);
+
+        auto model = base;
+        model.computeGradients(inputs.col(j), targets.col(j), gradients, [](size_t) {});
+        model.applyGradients(gradients, learningRate);
+        model.snapshot(batched);
+
+        check(maxDifference(batched, perSample) / learningRate < 1e-4, "computeGradients disagrees with updateWeights for sample " + std::to_string(j));
+    }
+
+    //the batch gradient is the sum of the per-sample ones
+    Perceptron<double>::Gradients batch, sum;
+    base.computeGradients(inputs, targets, batch, [](size_t) {});
+    for (Index j = 0; j < inputs.cols(); ++j) {
+        base.computeGradients(inputs.col(j), targets.col(j), gradients, [](size_t) {});
+        for (size_t l = 0; l < gradients.weights.size(); ++l) {
+            if (j == 0) {
+                sum.weights.push_back(gradients.weights[l]);
+                sum.biases.push_back(gradients.biases[l]);
+            }
+            else {
+                sum.weights[l] += gradients.weights[l];
+                sum.biases[l] += gradients.biases[l];
+            }
+        }
+    }
+    for (size_t l = 0; l < batch.weights.size(); ++l) {
+        check((batch.weights[l] - sum.weights[l]).cwiseAbs().maxCoeff() < 1e-12 and (batch.biases[l] - sum.biases[l]).cwiseAbs().maxCoeff() < 1e-12,
+              "Batch gradient of layer " + std::to_string(l) + " is not the sum of the per-sample gradients");
+    }
+    std::cout << "gradients: ok\n";
+}
+
+//with the default bucket size the tail of the btc model has to be reduced while the first layer's gradient is still being computed
+static void testBuckets() {
+    auto model = makeModel({
+            {"inputs", 3600},
+            {"layers", {
+                    {{"activation", "tanh"}, {"size", 320}},
+                    {{"activation", "tanh"}, {"size", 240}},
+                    {{"activation", "tanh"}, {"size", 48}},
+                    {{"activation", "tanh"}, {"size", 16}},
+                    {{"activation", "tanh"}, {"size", 1}}
+            }}
+    });
+    ShmSegment segment{1};
+    ShmTransport transport{segment, 0};
+    DataParallelTrainer<double> trainer{model, transport};
+    check(trainer.numBuckets() >= 2, "btc model gradients fit in " + std::to_string(trainer.numBuckets()) + " bucket, nothing overlaps the backward pass");
+    std::cout << "buckets: " << trainer.numBuckets() << ", ok\n";
+}
+
+//every worker must end up with the parameters of one process applying the averaged gradient of all workers' batches
+static void testTrainerSteps() {
+    const size_t numWorkers = 3, steps = 4, batchSize = 5;
+    const auto base = makeModel(smallModel);
+
+    std::vector<MatrixX<double>> inputs, targets;
+    for (size_t i = 0; i < steps * numWorkers; ++i) {
+        inputs.push_back(MatrixX<double>::Random(12, batchSize));
+        targets.push_back(MatrixX<double>::Random(2, batchSize));
+    }
+
+    auto reference = base;
+    Perceptron<double>::Gradients gradients, total;
+    for (size_t step = 0; step < steps; ++step) {
+        for (size_t rank = 0; rank < numWorkers; ++rank) {
+            reference.computeGradients(inputs[step * numWorkers + rank], targets[step * numWorkers + rank], gradients, [](size_t) {});
+            if (rank == 0) {
+                total = gradients;
+            }
+            else for (size_t l = 0; l < gradients.weights.size(); ++l) {
+                total.weights[l] += gradients.weights[l];
+                total.biases[l] += gradients.biases[l];
+            }
+        }
+        reference.applyGradients(total, 0.01 / numWorkers);
+    }
+    Perceptron<double>::Snapshot expected;
+    reference.snapshot(expected);
+
+    ShmSegment segment{numWorkers};
+    forkWorkers(numWorkers, [&](size_t rank) {
+        auto model = base;
+        ShmTransport transport{segment, rank};
+        DataParallelTrainer<double> trainer{model, transport, 64}; //tiny buckets, one per layer
+        trainer.broadcastParameters();
+        for (size_t step = 0; step < steps; ++step) {
+            trainer.step(inputs[step * numWorkers + rank], targets[step * numWorkers + rank], 0.01);
+        }
+
+        Perceptron<double>::Snapshot result;
+        model.snapshot(result);
+        check(maxDifference(result, expected) < 1e-12, "Worker " + std::to_string(rank) + " diverged from the single process result");
+    });
+    std::cout << "trainer steps over " << numWorkers << " ranks: ok\n";
+}
+
+int main() {
+    try {
+        testShmAllReduce();
+        testSocketAllReduce();
+        testBroadcast();
+        testGradients();
+        testBuckets();
+        testTrainerSteps();
+    }
+    catch (std::exception& e) {
+        std::cerr << "FAILED: " << e.what() << '\n';
+        return 1;
+    }
+}
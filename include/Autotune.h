@@ -0,0 +1,227 @@
+#ifndef PERCEPTRON_AUTOTUNE_H
+#define PERCEPTRON_AUTOTUNE_H
+
+#include "defs.h"
+#include "Perceptron.h"
+#include <chrono>
+#include <cstdlib>
+#include <optional>
+#include <thread>
+
+
+struct TunedConfig {
+    int inferenceThreads = 1;
+    size_t batchSize = 1;
+    //only set once the training step has been tuned, for batches of trainBatchSize samples
+    int trainThreads = 0;
+    size_t trainBatchSize = 0;
+
+    json toJson() const {
+        return {
+                {"inferenceThreads", inferenceThreads},
+                {"batchSize", batchSize},
+                {"trainThreads", trainThreads},
+                {"trainBatchSize", trainBatchSize}
+        };
+    }
+
+    static TunedConfig fromJson(const json& data) {
+        TunedConfig config;
+        try {
+            config.inferenceThreads = data.at("inferenceThreads").template get<int>();
+            config.batchSize = data.at("batchSize").template get<size_t>();
+            config.trainThreads = data.value("trainThreads", 0);
+            config.trainBatchSize = data.value("trainBatchSize", size_t{0});
+        }
+        catch (json::exception& e) {
+            throw std::invalid_argument(std::string{"Error encountered while parsing tuned configuration: "} + e.what());
+        }
+        return config;
+    }
+
+    friend std::ostream& operator<<(std::ostream& stream, const TunedConfig& config) {
+        return stream << config.toJson().dump();
+    }
+};
+
+/*
+ * Micro-benchmarks the forward and backward pass of a model's actual shape
+ * and remembers the fastest settings per host.
+ *
+ * cache file ($XDG_CACHE_HOME or ~/.cache)/perceptron/autotune.json:
+ *      { "<cpu model> x<hardware threads>": { "<model.json of the shape>": TunedConfig } }
+ *
+ * Forward passes are timed for every thread count and batch size;
+ * the chosen batch size is the smallest that reaches 90% of the best
+ * throughput, so latency-sensitive callers do not pay for a batch that
+ * barely helps.
+ *
+ * The backward pass is timed as the batched gradient computation of the
+ * data-parallel trainer, at the batch size the training run will use. The
+ * per-sample updates of a single-process run are matrix-vector products that
+ * eigen does not parallelise, so there is no thread count to tune for them.
+ * Tuning without a training batch size keeps the training settings already
+ * cached for the shape.
+ */
+template <Scalar T>
+class Autotuner {
+public:
+    static inline const std::vector<size_t> batchSizes{1, 8, 32, 128, 512};
+
+    //benchmarks with the given time budget per measurement and stores the winner in the cache
+    static TunedConfig tune(const Perceptron<T>& model, size_t trainBatchSize = 0, std::chrono::milliseconds budget = std::chrono::milliseconds{50}) {
+        const int initialThreads = Eigen::nbThreads();
+        TunedConfig config;
+        if (const auto previous = cached(model); previous and not trainBatchSize) {
+            config.trainThreads = previous->trainThreads;
+            config.trainBatchSize = previous->trainBatchSize;
+        }
+
+        struct Result { int threads; size_t batchSize; double samplesPerSecond; };
+        std::vector<Result> forward;
+        double bestBackward = 0;
+
+        const MatrixX<T> trainInputs = MatrixX<T>::Random(static_cast<Index>(model.numInputs()), static_cast<Index>(trainBatchSize));
+        const MatrixX<T> trainTargets = MatrixX<T>::Random(static_cast<Index>(model.numOutputs()), static_cast<Index>(trainBatchSize));
+        typename Perceptron<T>::Gradients gradients;
+
+        for (const int threads : threadCounts()) {
+            Eigen::setNbThreads(threads);
+
+            for (const size_t batchSize : batchSizes) {
+                const MatrixX<T> inputs = MatrixX<T>::Random(static_cast<Index>(model.numInputs()), static_cast<Index>(batchSize));
+                forward.push_back({threads, batchSize, measure(budget, batchSize, [&]() { return model.predictBatch(inputs)(0, 0); })});
+            }
+
+            if (trainBatchSize) {
+                const double backward = measure(budget, trainBatchSize, [&]() {
+                    return static_cast<T>(model.computeGradients(trainInputs, trainTargets, gradients, [](size_t) {}));
+                });
+                if (backward > bestBackward) {
+                    bestBackward = backward;
+                    config.trainThreads = threads;
+                    config.trainBatchSize = trainBatchSize;
+                }
+            }
+        }
+
+        Eigen::setNbThreads(initialThreads);
+
+        const double bestForward = ranges::max(forward, {}, &Result::samplesPerSecond).samplesPerSecond;
+        const auto chosen = ranges::min(
+                forward | views::filter([bestForward](const Result& r) { return r.samplesPerSecond >= 0.9 * bestForward; }),
+                [](const Result& a, const Result& b) {
+                    return std::tie(a.batchSize, b.samplesPerSecond) < std::tie(b.batchSize, a.samplesPerSecond);
+                }
+        );
+        config.inferenceThreads = chosen.threads;
+        config.batchSize = chosen.batchSize;
+
+        store(model, config);
+        return config;
+    }
+
+    static std::optional<TunedConfig> cached(const Perceptron<T>& model) {
+        const json cache = readCache();
+        const auto host = cache.find(hostKey());
+        if (host == cache.end()) {
+            return std::nullopt;
+        }
+        const auto entry = host->find(model.describe().dump());
+        if (entry == host->end()) {
+            return std::nullopt;
+        }
+        return TunedConfig::fromJson(*entry);
+    }
+
+    //runs the tuner when asked to, otherwise falls back to whatever an earlier run cached for this host and shape
+    static std::optional<TunedConfig> resolve(const Perceptron<T>& model, bool retune, size_t trainBatchSize = 0) {
+        if (retune) {
+            std::cout << "Autotuning for " << hostKey() << "...\n";
+            auto config = tune(model, trainBatchSize);
+            std::cout << "Tuned configuration: " << config << '\n';
+            return config;
+        }
+        return cached(model);
+    }
+
+    static fs::path cacheFile() {
+        if (const char* xdg = std::getenv("XDG_CACHE_HOME"); xdg and *xdg) {
+            return fs::path{xdg} / "perceptron" / "autotune.json";
+        }
+        if (const char* home = std::getenv("HOME"); home and *home) {
+            return fs::path{home} / ".cache" / "perceptron" / "autotune.json";
+        }
+        return fs::temp_directory_path() / "perceptron" / "autotune.json";
+    }
+
+    static std::string hostKey() {
+        std::string cpu = "unknown cpu";
+        if (std::ifstream file{"/proc/cpuinfo"}) {
+            std::string line;
+            while (std::getline(file, line)) {
+                if (line.starts_with("model name")) {
+                    cpu = line.substr(line.find(':') + 2);
+                    break;
+                }
+            }
+        }
+        return cpu + " x" + std::to_string(std::max(std::thread::hardware_concurrency(), 1u));
+    }
+
+private:
+    static std::vector<int> threadCounts() {
+        const int hardware = static_cast<int>(std::max(std::thread::hardware_concurrency(), 1u));
+        std::vector<int> counts;
+        for (int n = 1; n < hardware; n *= 2) {
+            counts.push_back(n);
+        }
+        counts.push_back(hardware);
+        return counts;
+    }
+
+    //samples per second of fn, which processes samplesPerCall samples per call
+    static double measure(std::chrono::milliseconds budget, size_t samplesPerCall, const auto& fn) {
+        using Clock = std::chrono::steady_clock;
+        volatile T sink = fn(); //warm up caches and any lazily allocated buffers
+
+        size_t calls = 0;
+        const auto start = Clock::now();
+        auto now = start;
+        while (now - start < budget or calls == 0) {
+            sink = fn();
+            ++calls;
+            now = Clock::now();
+        }
+        (void)sink;
+        return static_cast<double>(calls * samplesPerCall) / std::chrono::duration<double>(now - start).count();
+    }
+
+    static json readCache() {
+        if (std::ifstream file{cacheFile()}) {
+            try {
+                return json::parse(file);
+            }
+            catch (json::exception&) {
+                //a corrupt cache is only a missed optimisation, start over
+            }
+        }
+        return json::object();
+    }
+
+    static void store(const Perceptron<T>& model, const TunedConfig& config) {
+        const auto path = cacheFile();
+        json cache = readCache();
+        cache[hostKey()][model.describe().dump()] = config.toJson();
+
+        fs::create_directories(path.parent_path());
+        const auto staging = fs::path{path}.concat(".tmp");
+        if (std::ofstream file{staging}) {
+            file << cache.dump(4);
+        } else throw std::runtime_error("Could not create file " + staging.string());
+        fs::rename(staging, path);
+    }
+};
+
+
+#endif //PERCEPTRON_AUTOTUNE_H
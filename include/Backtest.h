@@ -0,0 +1,175 @@
+#ifndef PERCEPTRON_BACKTEST_H
+#define PERCEPTRON_BACKTEST_H
+
+#include "defs.h"
+#include "Perceptron.h"
+#include "TrainData.h"
+#include <chrono>
+#include <exception>
+#include <thread>
+
+
+/*
+ * Metrics are accumulated per shard and merged in shard order, so a given
+ * (model, data, shard count) always produces bit-identical results.
+ * The signal is read from the first model output, rounded at 0.5; the pnl
+ * assumes the input column holds price levels and goes long for one tick
+ * whenever the predicted signal is set.
+ */
+struct BacktestMetrics {
+    size_t samples = 0;
+    size_t values = 0; // samples * model outputs, the mean squared error averages over every output
+    size_t trades = 0;
+    double squaredError = 0;
+    double pnl = 0;
+    size_t confusion[2][2]{}; // [actual][predicted]
+
+    void merge(const BacktestMetrics& other) {
+        samples += other.samples;
+        values += other.values;
+        trades += other.trades;
+        squaredError += other.squaredError;
+        pnl += other.pnl;
+        for (int actual = 0; actual < 2; ++actual) {
+            for (int predicted = 0; predicted < 2; ++predicted) {
+                confusion[actual][predicted] += other.confusion[actual][predicted];
+            }
+        }
+    }
+
+    [[nodiscard]] double meanSquaredError() const {
+        return values ? squaredError / static_cast<double>(values) : 0;
+    }
+
+    [[nodiscard]] double hitRate() const {
+        return samples ? static_cast<double>(confusion[0][0] + confusion[1][1]) / static_cast<double>(samples) : 0;
+    }
+
+    friend std::ostream& operator<<(std::ostream& stream, const BacktestMetrics& m) {
+        stream << "Samples: " << m.samples << '\n'
+               << "Mean squared error: " << m.meanSquaredError() << '\n'
+               << "Hit rate: " << m.hitRate() << '\n'
+               << "Confusion (actual x predicted): [[" << m.confusion[0][0] << ", " << m.confusion[0][1]
+               << "], [" << m.confusion[1][0] << ", " << m.confusion[1][1] << "]]\n"
+               << "Trades: " << m.trades << ", pnl: " << m.pnl << '\n';
+        return stream;
+    }
+};
+
+struct BacktestReport {
+    BacktestMetrics total;
+    std::vector<BacktestMetrics> shards;
+    size_t ticks = 0;
+    double seconds = 0;
+
+    [[nodiscard]] double ticksPerSecond() const {
+        return seconds > 0 ? static_cast<double>(ticks) / seconds : 0;
+    }
+
+    friend std::ostream& operator<<(std::ostream& stream, const BacktestReport& r) {
+        stream << r.total
+               << "Shards: " << r.shards.size() << '\n'
+               << "Ticks: " << r.ticks << " in " << r.seconds << "s (" << r.ticksPerSecond() << " ticks/s)\n";
+        return stream;
+    }
+};
+
+template <Scalar T>
+class Backtester {
+public:
+    Backtester(const Perceptron<T>& model, const TrainData<T>& data, size_t numShards = std::thread::hardware_concurrency(), size_t batchSize = 256)
+    : model(model), data(data), numShards(std::max<size_t>(numShards, 1)), batchSize(std::max<size_t>(batchSize, 1)) {
+        if (data.size() <= std::max(model.numInputs(), model.numOutputs())) {
+            throw std::invalid_argument("Data set of " + std::to_string(data.size()) + " ticks is shorter than one model window");
+        }
+    }
+
+    BacktestReport run() const {
+        // one window per sample; the last sample needs the following tick for its pnl
+        const size_t windows = data.size() - std::max(model.numInputs(), model.numOutputs());
+        const size_t shardCount = std::min(numShards, windows);
+
+        BacktestReport report;
+        report.shards.resize(shardCount);
+        std::vector<std::exception_ptr> errors(shardCount);
+
+        // shards already run one per thread, keep eigen from spawning its own pool inside each of them
+        const int eigenThreads = Eigen::nbThreads();
+        Eigen::setNbThreads(1);
+
+        const auto start = std::chrono::steady_clock::now();
+        {
+            std::vector<std::jthread> workers;
+            workers.reserve(shardCount);
+            for (size_t shard = 0; shard < shardCount; ++shard) {
+                workers.emplace_back([&, shard]() {
+                    try {
+                        report.shards[shard] = runShard(shard * windows / shardCount, (shard + 1) * windows / shardCount);
+                    }
+                    catch (...) {
+                        errors[shard] = std::current_exception();
+                    }
+                });
+            }
+        }
+        const auto end = std::chrono::steady_clock::now();
+
+        Eigen::setNbThreads(eigenThreads);
+
+        for (const auto& error : errors) {
+            if (error) std::rethrow_exception(error);
+        }
+
+        for (const auto& shard : report.shards) {
+            report.total.merge(shard);
+        }
+        report.ticks = windows;
+        report.seconds = std::chrono::duration<double>(end - start).count();
+        return report;
+    }
+
+private:
+    // scores windows [begin, end); the ticks read span [begin, end + inputs], overlapping the next shard by one window
+    BacktestMetrics runShard(size_t begin, size_t end) const {
+        const auto& prices = data.getInputData();
+        const auto& signals = data.getOutputData();
+        const size_t inputs = model.numInputs(), outputs = model.numOutputs();
+
+        BacktestMetrics metrics;
+
+        for (size_t batch = begin; batch < end; batch += batchSize) {
+            const size_t count = std::min(batchSize, end - batch);
+
+            // consecutive windows overlap, so column j simply starts one tick after column j - 1
+            Map<const MatrixX<T>, Unaligned, OuterStride<>> windows{prices.data() + batch, static_cast<Index>(inputs), static_cast<Index>(count), OuterStride<>{1}};
+            Map<const MatrixX<T>, Unaligned, OuterStride<>> targets{signals.data() + batch + inputs - outputs, static_cast<Index>(outputs), static_cast<Index>(count), OuterStride<>{1}};
+
+            const MatrixX<T> predictions = model.predictBatch(windows);
+
+            metrics.squaredError += static_cast<double>((targets - predictions).squaredNorm());
+
+            for (size_t j = 0; j < count; ++j) {
+                const int actual = targets(0, j) >= T(0.5);
+                const int predicted = predictions(0, j) >= T(0.5);
+                ++metrics.confusion[actual][predicted];
+
+                if (predicted) {
+                    const size_t last = batch + j + inputs - 1;
+                    metrics.pnl += static_cast<double>(prices[last + 1] - prices[last]);
+                    ++metrics.trades;
+                }
+            }
+            metrics.samples += count;
+            metrics.values += count * outputs;
+        }
+
+        return metrics;
+    }
+
+    const Perceptron<T>& model;
+    const TrainData<T>& data;
+    const size_t numShards, batchSize;
+};
+
+
+#endif //PERCEPTRON_BACKTEST_H
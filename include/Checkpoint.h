@@ -0,0 +1,272 @@
+#ifndef PERCEPTRON_CHECKPOINT_H
+#define PERCEPTRON_CHECKPOINT_H
+
+#include "defs.h"
+#include "Perceptron.h"
+#include <array>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <exception>
+#include <fcntl.h>
+#include <iomanip>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <thread>
+#include <unistd.h>
+
+
+//everything besides the model parameters that is needed to continue a training run where it stopped
+struct TrainingState {
+    size_t epoch = 0; //next epoch to run
+    std::string rngState;
+    double learningRate = 0;
+    std::vector<size_t> outliers;
+
+    json toJson() const {
+        return {
+                {"epoch", epoch},
+                {"rngState", rngState},
+                {"learningRate", learningRate},
+                {"outliers", outliers}
+        };
+    }
+
+    static TrainingState fromJson(const json& data) {
+        TrainingState state;
+        try {
+            state.epoch = data.at("epoch").template get<size_t>();
+            state.rngState = data.at("rngState").template get<std::string>();
+            state.learningRate = data.at("learningRate").template get<double>();
+            state.outliers = data.at("outliers").template get<std::vector<size_t>>();
+        }
+        catch (json::exception& e) {
+            throw std::invalid_argument(std::string{"Error encountered while parsing training state: "} + e.what());
+        }
+        return state;
+    }
+};
+
+/*
+ * folder layout:
+ *      epoch-NNNNNNNN/     -> model folder as written by saveToFolder, plus state.json
+ *      latest              -> name of the newest complete checkpoint folder
+ *
+ * Each checkpoint is written to a .tmp folder and renamed into place before
+ * latest is (atomically) replaced, so a crash never leaves latest pointing at
+ * a partial checkpoint. Files and folders are fsynced before every rename
+ * that publishes them, which extends that to an OS crash or power loss.
+ */
+template <Scalar T>
+class Checkpointer {
+public:
+    explicit Checkpointer(fs::path root, size_t keep = 2)
+    : root(std::move(root)), keep(std::max<size_t>(keep, 1)), writer([this](std::stop_token token) { writerLoop(token); }) {}
+
+    Checkpointer(const Checkpointer&) = delete;
+    Checkpointer& operator=(const Checkpointer&) = delete;
+
+    ~Checkpointer() {
+        {
+            std::unique_lock lock{mutex};
+            written.wait(lock, [this]() { return idle(); });
+            writer.request_stop(); //under the lock so the writer cannot miss it between its check and its wait
+        }
+        ready.notify_all();
+    }
+
+    /*
+     * copies the parameters into a free buffer and returns, the write itself happens on the background thread;
+     * a failed earlier write is rethrown only after this checkpoint has been queued, so it does not cost this one as well
+     */
+    void submit(const Perceptron<T>& model, TrainingState state) {
+        Slot* slot;
+        {
+            std::unique_lock lock{mutex};
+            written.wait(lock, [this]() { return ranges::any_of(slots, [](const Slot& s) { return s.status == Slot::FREE; }); });
+            slot = &*ranges::find(slots, Slot::FREE, &Slot::status);
+            slot->status = Slot::FILLING;
+        }
+
+        model.snapshot(slot->model);
+        slot->state = std::move(state);
+
+        {
+            std::lock_guard lock{mutex};
+            slot->status = Slot::READY;
+            slot->sequence = nextSequence++;
+        }
+        ready.notify_one();
+
+        std::lock_guard lock{mutex};
+        rethrowError();
+    }
+
+    //blocks until every submitted checkpoint is on disk
+    void flush() {
+        std::unique_lock lock{mutex};
+        written.wait(lock, [this]() { return error or idle(); });
+        rethrowError();
+    }
+
+    //removes all checkpoints, e.g. once the final model has been saved; a failed write no longer matters then
+    void clear() {
+        {
+            std::unique_lock lock{mutex};
+            written.wait(lock, [this]() { return idle(); });
+            error = nullptr;
+        }
+        fs::remove_all(root);
+    }
+
+    static std::optional<fs::path> latest(const fs::path& root) {
+        std::ifstream file{root / "latest"};
+        std::string name;
+        if (not file or not std::getline(file, name) or name.empty() or not fs::exists(root / name)) {
+            return std::nullopt;
+        }
+        return root / name;
+    }
+
+    static TrainingState readState(const fs::path& checkpoint) {
+        const auto path = checkpoint / "state.json";
+        if (std::ifstream file{path}) {
+            try {
+                return TrainingState::fromJson(json::parse(file));
+            }
+            catch (json::exception& e) {
+                throw std::runtime_error("Could not parse file " + path.string() + ": " + e.what());
+            }
+        }
+        throw std::runtime_error("Could not find file " + path.string());
+    }
+
+private:
+    struct Slot {
+        enum Status { FREE, FILLING, READY, WRITING } status = FREE;
+        size_t sequence = 0;
+        typename Perceptron<T>::Snapshot model;
+        TrainingState state;
+    };
+
+    bool idle() const {
+        return ranges::none_of(slots, [](const Slot& s) { return s.status == Slot::READY or s.status == Slot::WRITING; });
+    }
+
+    void rethrowError() {
+        if (error) {
+            std::rethrow_exception(std::exchange(error, nullptr));
+        }
+    }
+
+    void writerLoop(std::stop_token token) {
+        std::unique_lock lock{mutex};
+        while (true) {
+            ready.wait(lock, [&]() { return token.stop_requested() or ranges::any_of(slots, [](const Slot& s) { return s.status == Slot::READY; }); });
+
+            Slot* next = nullptr;
+            for (auto& slot : slots) {
+                if (slot.status == Slot::READY and (not next or slot.sequence < next->sequence)) {
+                    next = &slot;
+                }
+            }
+            if (not next) {
+                return; //stop requested and nothing left to write
+            }
+
+            next->status = Slot::WRITING;
+            lock.unlock();
+            try {
+                write(*next);
+            }
+            catch (...) {
+                lock.lock();
+                error = std::current_exception();
+                lock.unlock();
+            }
+            lock.lock();
+            next->status = Slot::FREE;
+            written.notify_all();
+        }
+    }
+
+    void write(const Slot& slot) const {
+        std::ostringstream name;
+        name << "epoch-" << std::setw(8) << std::setfill('0') << slot.state.epoch;
+
+        const fs::path target = root / name.str(), staging = root / (name.str() + ".tmp");
+
+        if (fs::create_directories(root)) {
+            sync(fs::absolute(root).parent_path());
+        }
+        fs::remove_all(staging);
+        fs::create_directory(staging);
+
+        slot.model.saveToFolder(staging);
+        if (std::ofstream stateFile{staging / "state.json"}) {
+            stateFile << slot.state.toJson();
+        } else throw std::runtime_error("Could not create file " + (staging / "state.json").string());
+
+        for (const auto& entry : fs::directory_iterator{staging}) {
+            sync(entry.path());
+        }
+        sync(staging);
+
+        fs::remove_all(target);
+        fs::rename(staging, target);
+        sync(root);
+
+        if (std::ofstream latestFile{root / "latest.tmp"}) {
+            latestFile << name.str() << '\n';
+        } else throw std::runtime_error("Could not create file " + (root / "latest.tmp").string());
+        sync(root / "latest.tmp");
+        fs::rename(root / "latest.tmp", root / "latest");
+        sync(root);
+
+        prune();
+    }
+
+    //works for folders as well, which makes the names created or renamed in them durable
+    static void sync(const fs::path& path) {
+        const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            throw std::runtime_error("Could not open " + path.string() + " for syncing: " + std::strerror(errno));
+        }
+        const int rc = ::fsync(fd);
+        const int savedErrno = errno;
+        ::close(fd);
+        if (rc < 0) {
+            throw std::runtime_error("Could not sync " + path.string() + ": " + std::strerror(savedErrno));
+        }
+    }
+
+    //keeps the newest checkpoints, folder names sort by epoch
+    void prune() const {
+        std::vector<fs::path> checkpoints;
+        for (const auto& entry : fs::directory_iterator{root}) {
+            const auto name = entry.path().filename().string();
+            if (entry.is_directory() and name.starts_with("epoch-") and not name.ends_with(".tmp")) {
+                checkpoints.push_back(entry.path());
+            }
+        }
+        ranges::sort(checkpoints);
+        for (size_t i = 0; i + keep < checkpoints.size(); ++i) {
+            fs::remove_all(checkpoints[i]);
+        }
+    }
+
+    const fs::path root;
+    const size_t keep;
+
+    std::array<Slot, 2> slots;
+    size_t nextSequence = 0;
+    std::exception_ptr error;
+
+    std::mutex mutex;
+    std::condition_variable ready, written;
+    std::jthread writer; //declared last so that it starts after, and is joined before, everything it uses
+};
+
+
+#endif //PERCEPTRON_CHECKPOINT_H
@@ -0,0 +1,498 @@
+#ifndef PERCEPTRON_COLLECTIVE_H
+#define PERCEPTRON_COLLECTIVE_H
+
+#include "defs.h"
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <span>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+
+/*
+ * Point to point link of a ring of worker processes: every rank sends to
+ * rank + 1 and receives from rank - 1 (mod size). exchange does both at once,
+ * so a full ring of blocking exchanges cannot deadlock.
+ */
+class Transport {
+public:
+    Transport(size_t rank, size_t size)
+    : rank_(rank), size_(size) {
+        if (size == 0 or rank >= size) {
+            throw std::invalid_argument("Invalid rank " + std::to_string(rank) + " for " + std::to_string(size) + " workers");
+        }
+    }
+
+    virtual ~Transport() = default;
+
+    virtual void exchange(const void* send, size_t sendBytes, void* recv, size_t recvBytes) = 0;
+
+    [[nodiscard]] size_t rank() const {
+        return rank_;
+    }
+
+    [[nodiscard]] size_t size() const {
+        return size_;
+    }
+
+protected:
+    //gives up when a peer has made no progress for this long, which usually means it died
+    static constexpr std::chrono::seconds stallTimeout{120};
+
+private:
+    size_t rank_, size_;
+};
+
+/*
+ * Shared memory rings for workers forked from one parent. The segment is an
+ * anonymous shared mapping, so it must be created before forking; it holds
+ * one single-producer single-consumer byte ring per edge of the ring, plus an
+ * abort flag that lets a failing worker release the others.
+ */
+class ShmSegment {
+public:
+    ShmSegment(size_t numWorkers, size_t channelBytes = size_t{1} << 20)
+    : numWorkers(numWorkers), channelBytes((channelBytes + 63) / 64 * 64), length(sizeof(Header) + numWorkers * (sizeof(Channel) + this->channelBytes)) {
+        void* mapping = ::mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (mapping == MAP_FAILED) {
+            throw std::runtime_error(std::string{"Could not map shared memory: "} + std::strerror(errno));
+        }
+        base = static_cast<char*>(mapping);
+        new (base) Header{};
+        for (size_t i = 0; i < numWorkers; ++i) {
+            new (channel(i)) Channel{};
+        }
+    }
+
+    ShmSegment(const ShmSegment&) = delete;
+    ShmSegment& operator=(const ShmSegment&) = delete;
+
+    ~ShmSegment() {
+        ::munmap(base, length);
+    }
+
+    void abort() {
+        reinterpret_cast<Header*>(base)->aborted = true;
+    }
+
+    [[nodiscard]] bool aborted() const {
+        return reinterpret_cast<const Header*>(base)->aborted;
+    }
+
+private:
+    friend class ShmTransport;
+
+    struct alignas(64) Header {
+        std::atomic<bool> aborted{false};
+    };
+
+    struct alignas(64) Channel {
+        alignas(64) std::atomic<uint64_t> head{0}; //bytes written so far
+        alignas(64) std::atomic<uint64_t> tail{0}; //bytes read so far
+    };
+
+    Channel* channel(size_t index) const {
+        return reinterpret_cast<Channel*>(base + sizeof(Header) + index * (sizeof(Channel) + channelBytes));
+    }
+
+    char* channelData(size_t index) const {
+        return reinterpret_cast<char*>(channel(index)) + sizeof(Channel);
+    }
+
+    const size_t numWorkers, channelBytes, length;
+    char* base;
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "shared memory channels need address free atomics");
+
+class ShmTransport : public Transport {
+public:
+    ShmTransport(ShmSegment& segment, size_t rank)
+    : Transport(rank, segment.numWorkers), segment(segment) {}
+
+    void exchange(const void* send, size_t sendBytes, void* recv, size_t recvBytes) override {
+        auto* out = segment.channel(rank());
+        auto* in = segment.channel((rank() + size() - 1) % size());
+        char* outData = segment.channelData(rank());
+        const char* inData = segment.channelData((rank() + size() - 1) % size());
+        const size_t capacity = segment.channelBytes;
+
+        const auto* src = static_cast<const char*>(send);
+        auto* dst = static_cast<char*>(recv);
+        size_t sent = 0, received = 0;
+        auto lastProgress = std::chrono::steady_clock::now();
+
+        while (sent < sendBytes or received < recvBytes) {
+            bool progress = false;
+
+            if (sent < sendBytes) {
+                const uint64_t head = out->head.load(std::memory_order_relaxed);
+                const uint64_t tail = out->tail.load(std::memory_order_acquire);
+                const size_t n = std::min<size_t>(sendBytes - sent, capacity - (head - tail));
+                if (n) {
+                    copyIn(outData, capacity, head, src + sent, n);
+                    out->head.store(head + n, std::memory_order_release);
+                    sent += n;
+                    progress = true;
+                }
+            }
+
+            if (received < recvBytes) {
+                const uint64_t tail = in->tail.load(std::memory_order_relaxed);
+                const uint64_t head = in->head.load(std::memory_order_acquire);
+                const size_t n = std::min<size_t>(recvBytes - received, head - tail);
+                if (n) {
+                    copyOut(inData, capacity, tail, dst + received, n);
+                    in->tail.store(tail + n, std::memory_order_release);
+                    received += n;
+                    progress = true;
+                }
+            }
+
+            if (progress) {
+                lastProgress = std::chrono::steady_clock::now();
+                continue;
+            }
+            if (segment.aborted()) {
+                throw std::runtime_error("Another worker aborted");
+            }
+            if (std::chrono::steady_clock::now() - lastProgress > stallTimeout) {
+                throw std::runtime_error("Timed out waiting for worker " + std::to_string((rank() + size() - 1) % size()));
+            }
+            std::this_thread::yield();
+        }
+    }
+
+private:
+    static void copyIn(char* ring, size_t capacity, uint64_t position, const char* src, size_t n) {
+        const size_t offset = position % capacity, first = std::min(n, capacity - offset);
+        std::memcpy(ring + offset, src, first);
+        std::memcpy(ring, src + first, n - first);
+    }
+
+    static void copyOut(const char* ring, size_t capacity, uint64_t position, char* dst, size_t n) {
+        const size_t offset = position % capacity, first = std::min(n, capacity - offset);
+        std::memcpy(dst, ring + offset, first);
+        std::memcpy(dst + first, ring, n - first);
+    }
+
+    ShmSegment& segment;
+};
+
+/*
+ * TCP ring for workers on several hosts. peers lists "host:port" for every
+ * rank in rank order; each rank listens on its own address, connects to the
+ * next rank from its own host and accepts the previous one.
+ *
+ * An accepted connection is only kept if it comes from the previous rank's
+ * host and opens with a hello naming that rank and the ring size, anything
+ * else is dropped. This keeps stray or misconfigured clients out of the
+ * ring; it is not authentication, the ring should still run on a trusted
+ * network.
+ */
+class SocketTransport : public Transport {
+public:
+    SocketTransport(size_t rank, const std::vector<std::string>& peers)
+    : Transport(rank, peers.size()) {
+        if (size() == 1) {
+            return;
+        }
+
+        const auto [ownHost, ownPort] = splitAddress(peers[rank]);
+        const int listener = listenOn(ownHost, ownPort);
+
+        try {
+            const auto [nextHost, nextPort] = splitAddress(peers[(rank + 1) % size()]);
+            nextFd = connectTo(nextHost, nextPort, ownHost);
+            const Hello hello{helloMagic, rank, size()};
+            if (::send(nextFd, &hello, sizeof(hello), MSG_NOSIGNAL) != sizeof(hello)) {
+                throw std::runtime_error("Could not greet worker " + std::to_string((rank + 1) % size()));
+            }
+
+            const size_t prevRank = (rank + size() - 1) % size();
+            prevFd = acceptFrom(listener, splitAddress(peers[prevRank]).first, {helloMagic, prevRank, size()});
+        }
+        catch (...) {
+            ::close(listener);
+            closeAll();
+            throw;
+        }
+        ::close(listener);
+
+        for (const int fd : {nextFd, prevFd}) {
+            const int one = 1;
+            ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+        }
+    }
+
+    SocketTransport(const SocketTransport&) = delete;
+    SocketTransport& operator=(const SocketTransport&) = delete;
+
+    ~SocketTransport() override {
+        closeAll();
+    }
+
+    void exchange(const void* send, size_t sendBytes, void* recv, size_t recvBytes) override {
+        if (size() == 1) {
+            std::memcpy(recv, send, std::min(sendBytes, recvBytes));
+            return;
+        }
+
+        const auto* src = static_cast<const char*>(send);
+        auto* dst = static_cast<char*>(recv);
+        size_t sent = 0, received = 0;
+
+        while (sent < sendBytes or received < recvBytes) {
+            pollfd fds[2] = {
+                    {nextFd, static_cast<short>(sent < sendBytes ? POLLOUT : 0), 0},
+                    {prevFd, static_cast<short>(received < recvBytes ? POLLIN : 0), 0}
+            };
+            const int ready = ::poll(fds, 2, static_cast<int>(std::chrono::milliseconds{stallTimeout}.count()));
+            if (ready == 0) {
+                throw std::runtime_error("Timed out waiting for a neighbouring worker");
+            }
+            if (ready < 0) {
+                if (errno == EINTR) continue;
+                throw std::runtime_error(std::string{"poll failed: "} + std::strerror(errno));
+            }
+
+            if (fds[0].revents & (POLLOUT | POLLERR | POLLHUP)) {
+                const ssize_t n = ::send(nextFd, src + sent, sendBytes - sent, MSG_NOSIGNAL);
+                if (n < 0 and errno != EAGAIN and errno != EINTR) {
+                    throw std::runtime_error(std::string{"Lost connection to next worker: "} + std::strerror(errno));
+                }
+                sent += static_cast<size_t>(std::max<ssize_t>(n, 0));
+            }
+            if (fds[1].revents & (POLLIN | POLLERR | POLLHUP)) {
+                const ssize_t n = ::recv(prevFd, dst + received, recvBytes - received, 0);
+                if (n == 0 or (n < 0 and errno != EAGAIN and errno != EINTR)) {
+                    throw std::runtime_error("Lost connection to previous worker");
+                }
+                received += static_cast<size_t>(std::max<ssize_t>(n, 0));
+            }
+        }
+    }
+
+private:
+    static std::pair<std::string, std::string> splitAddress(const std::string& address) {
+        const auto colon = address.rfind(':');
+        if (colon == std::string::npos) {
+            throw std::invalid_argument("Expected host:port, got " + address);
+        }
+        return {address.substr(0, colon), address.substr(colon + 1)};
+    }
+
+    struct Hello {
+        uint64_t magic, rank, size;
+
+        bool operator==(const Hello&) const = default;
+    };
+
+    static constexpr uint64_t helloMagic = 0x70657263'72696e67; //"percring"
+
+    //a client that connected but does not send its hello is dropped after this long
+    static constexpr std::chrono::seconds helloTimeout{10};
+
+    static addrinfo* resolve(const std::string& host, const std::string& port, int flags = 0) {
+        addrinfo hints{}, *result;
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = flags;
+        if (const int rc = ::getaddrinfo(host.c_str(), port.c_str(), &hints, &result); rc != 0) {
+            throw std::runtime_error("Could not resolve " + host + ":" + port + ": " + ::gai_strerror(rc));
+        }
+        return result;
+    }
+
+    static bool sameHost(const sockaddr_storage& address, const addrinfo* candidates) {
+        for (auto* info = candidates; info; info = info->ai_next) {
+            if (info->ai_family != address.ss_family) continue;
+            if (address.ss_family == AF_INET
+                and reinterpret_cast<const sockaddr_in*>(&address)->sin_addr.s_addr == reinterpret_cast<const sockaddr_in*>(info->ai_addr)->sin_addr.s_addr) {
+                return true;
+            }
+            if (address.ss_family == AF_INET6
+                and std::memcmp(&reinterpret_cast<const sockaddr_in6*>(&address)->sin6_addr, &reinterpret_cast<const sockaddr_in6*>(info->ai_addr)->sin6_addr, sizeof(in6_addr)) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static int listenOn(const std::string& host, const std::string& port) {
+        addrinfo* result = resolve(host, port, AI_PASSIVE);
+
+        int fd = -1;
+        for (auto* info = result; info and fd < 0; info = info->ai_next) {
+            fd = ::socket(info->ai_family, info->ai_socktype | SOCK_CLOEXEC, info->ai_protocol);
+            if (fd < 0) continue;
+            const int one = 1;
+            ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+            if (::bind(fd, info->ai_addr, info->ai_addrlen) < 0 or ::listen(fd, 8) < 0) {
+                ::close(fd);
+                fd = -1;
+            }
+        }
+        ::freeaddrinfo(result);
+
+        if (fd < 0) {
+            throw std::runtime_error("Could not listen on " + host + ":" + port);
+        }
+        return fd;
+    }
+
+    //the next rank may not be listening yet, keep retrying until the stall timeout.
+    //the connection leaves from ownHost so that the next rank sees the address it expects
+    static int connectTo(const std::string& host, const std::string& port, const std::string& ownHost) {
+        const auto deadline = std::chrono::steady_clock::now() + stallTimeout;
+        while (true) {
+            addrinfo* result = resolve(host, port);
+            addrinfo* local = resolve(ownHost, "0", AI_PASSIVE);
+
+            int fd = -1;
+            for (auto* info = result; info and fd < 0; info = info->ai_next) {
+                const auto* source = local;
+                while (source and source->ai_family != info->ai_family) {
+                    source = source->ai_next;
+                }
+                if (not source) continue;
+
+                fd = ::socket(info->ai_family, info->ai_socktype | SOCK_CLOEXEC, info->ai_protocol);
+                if (fd >= 0 and (::bind(fd, source->ai_addr, source->ai_addrlen) < 0 or ::connect(fd, info->ai_addr, info->ai_addrlen) < 0)) {
+                    ::close(fd);
+                    fd = -1;
+                }
+            }
+            ::freeaddrinfo(local);
+            ::freeaddrinfo(result);
+
+            if (fd >= 0) {
+                return fd;
+            }
+            if (std::chrono::steady_clock::now() > deadline) {
+                throw std::runtime_error("Could not connect to " + host + ":" + port);
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds{100});
+        }
+    }
+
+    static int acceptFrom(int listener, const std::string& host, const Hello& expected) {
+        addrinfo* allowed = resolve(host, "0");
+        const auto deadline = std::chrono::steady_clock::now() + stallTimeout;
+
+        while (true) {
+            const auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+            pollfd fd{listener, POLLIN, 0};
+            if (remaining.count() <= 0 or ::poll(&fd, 1, static_cast<int>(remaining.count())) <= 0) {
+                ::freeaddrinfo(allowed);
+                throw std::runtime_error("Timed out waiting for worker " + std::to_string(expected.rank) + " to connect");
+            }
+
+            sockaddr_storage address{};
+            socklen_t length = sizeof(address);
+            const int client = ::accept4(listener, reinterpret_cast<sockaddr*>(&address), &length, SOCK_CLOEXEC);
+            if (client < 0) {
+                continue;
+            }
+            if (sameHost(address, allowed) and readHello(client) == expected) {
+                ::freeaddrinfo(allowed);
+                return client;
+            }
+            ::close(client);
+        }
+    }
+
+    static Hello readHello(int fd) {
+        Hello hello{};
+        auto* dst = reinterpret_cast<char*>(&hello);
+        size_t received = 0;
+        const auto deadline = std::chrono::steady_clock::now() + helloTimeout;
+
+        while (received < sizeof(hello)) {
+            const auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+            pollfd poller{fd, POLLIN, 0};
+            if (remaining.count() <= 0 or ::poll(&poller, 1, static_cast<int>(remaining.count())) <= 0) {
+                return {};
+            }
+            const ssize_t n = ::recv(fd, dst + received, sizeof(hello) - received, 0);
+            if (n <= 0) {
+                return {};
+            }
+            received += static_cast<size_t>(n);
+        }
+        return hello;
+    }
+
+    void closeAll() {
+        for (int* fd : {&nextFd, &prevFd}) {
+            if (*fd >= 0) {
+                ::close(*fd);
+                *fd = -1;
+            }
+        }
+    }
+
+    int nextFd = -1, prevFd = -1;
+};
+
+/*
+ * In place sum over all ranks. data is cut into one chunk per rank; a
+ * reduce-scatter pass leaves every rank with one fully summed chunk and an
+ * all-gather pass circulates those, so each rank sends and receives about
+ * 2 * data.size() values regardless of the number of workers.
+ */
+template <Scalar T>
+void ringAllReduce(Transport& transport, std::span<T> data) {
+    const size_t size = transport.size(), rank = transport.rank();
+    if (size == 1 or data.empty()) {
+        return;
+    }
+
+    auto chunk = [&](size_t index) {
+        index %= size;
+        return data.subspan(index * data.size() / size, (index + 1) * data.size() / size - index * data.size() / size);
+    };
+
+    std::vector<T> incoming(data.size() / size + 1);
+
+    for (size_t step = 0; step + 1 < size; ++step) {
+        const auto out = chunk(rank + size - step), in = chunk(rank + size - step - 1);
+        transport.exchange(out.data(), out.size_bytes(), incoming.data(), in.size_bytes());
+        for (size_t i = 0; i < in.size(); ++i) {
+            in[i] += incoming[i];
+        }
+    }
+
+    for (size_t step = 0; step + 1 < size; ++step) {
+        const auto out = chunk(rank + size + 1 - step), in = chunk(rank + size - step);
+        transport.exchange(out.data(), out.size_bytes(), in.data(), in.size_bytes());
+    }
+}
+
+/*
+ * Copies rank 0's bytes to every rank. Each step passes the whole buffer one
+ * hop along the ring, so this is only meant for a handful of values; model
+ * parameters go through ringAllReduce instead.
+ */
+inline void ringBroadcast(Transport& transport, std::span<std::byte> data) {
+    std::vector<std::byte> incoming(data.size());
+    for (size_t step = 0; step + 1 < transport.size(); ++step) {
+        transport.exchange(data.data(), data.size(), incoming.data(), incoming.size());
+        if (transport.rank() == step + 1) {
+            ranges::copy(incoming, data.begin());
+        }
+    }
+}
+
+
+#endif //PERCEPTRON_COLLECTIVE_H
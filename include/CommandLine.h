@@ -0,0 +1,34 @@
+#ifndef PERCEPTRON_COMMANDLINE_H
+#define PERCEPTRON_COMMANDLINE_H
+
+#include "defs.h"
+#include <charconv>
+#include <optional>
+#include <string_view>
+
+
+//argument following option, if option was given
+inline std::optional<std::string_view> optionalValue(const std::vector<std::string_view>& args, std::string_view option) {
+    const auto it = ranges::find(args, option);
+    if (it == args.end() or it + 1 == args.end()) {
+        return std::nullopt;
+    }
+    return it[1];
+}
+
+//numeric argument following option, or fallback if option was not given
+inline size_t optionalSize(const std::vector<std::string_view>& args, std::string_view option, size_t fallback) {
+    const auto value = optionalValue(args, option);
+    if (not value) {
+        return fallback;
+    }
+    size_t result{};
+    const auto [end, ec] = std::from_chars(value->data(), value->data() + value->size(), result);
+    if (ec != std::errc{} or end != value->data() + value->size()) {
+        throw std::invalid_argument("Invalid value for " + std::string{option} + ": " + std::string{*value});
+    }
+    return result;
+}
+
+
+#endif //PERCEPTRON_COMMANDLINE_H
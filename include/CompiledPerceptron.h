@@ -0,0 +1,188 @@
+#ifndef PERCEPTRON_COMPILEDPERCEPTRON_H
+#define PERCEPTRON_COMPILEDPERCEPTRON_H
+
+#include "defs.h"
+#include <array>
+#include <cmath>
+
+
+/*
+ * Inference-only copy of a Perceptron with the weights repacked once for
+ * single-sample latency.
+ *
+ * packed layer layout (one arena for the whole network, layers back to back):
+ *      for every panel of panelRows output rows (widePanelRows, or
+ *      narrowPanelRows for layers narrower than one wide panel):
+ *          for every input column k:
+ *              panelRows weights of column k, contiguous
+ *      bias, zero padded to a whole number of panels
+ *
+ * A panel is streamed front to back exactly once per prediction while its
+ * panelRows accumulators stay in vector registers, and bias and activation
+ * are applied before the panel is stored. Layers no wider than
+ * maxStackWidth pass their activations through two buffers on the stack, so
+ * the small tail layers run back to back in one call without touching the heap.
+ */
+template <Scalar T>
+class CompiledPerceptron {
+public:
+    static constexpr Index lanes = internal::packet_traits<T>::size;
+    static constexpr Index widePanelRows = 4 * lanes; //independent accumulator vectors per panel
+    static constexpr Index narrowPanelRows = lanes; //keeps the 16 and 1 wide tail layers from computing mostly padding
+    static constexpr Index maxStackWidth = 1024;
+
+    //modelLayers runs first to last, each with weights, bias and activationFuncID
+    CompiledPerceptron(size_t inputs, const auto& modelLayers)
+    : inputSize(inputs), maxWidth(0) {
+        size_t arenaSize = 0;
+        for (const auto& layer : modelLayers) {
+            const Index panelRows = (layer.weights.rows() < widePanelRows ? narrowPanelRows : widePanelRows);
+            const Index panels = (layer.weights.rows() + panelRows - 1) / panelRows;
+            layers.push_back({
+                layer.weights.rows(),
+                layer.weights.cols(),
+                panelRows,
+                panels,
+                layer.activationFuncID,
+                arenaSize,
+                arenaSize + static_cast<size_t>(panels * panelRows * layer.weights.cols())
+            });
+            arenaSize = layers.back().biasOffset + static_cast<size_t>(panels * panelRows);
+            maxWidth = std::max(maxWidth, panels * panelRows);
+        }
+
+        arena.assign(arenaSize, T(0));
+
+        size_t l = 0;
+        for (const auto& layer : modelLayers) {
+            const auto& packed = layers[l++];
+            const Index panelRows = packed.panelRows;
+
+            for (Index panel = 0; panel < packed.panels; ++panel) {
+                T* dest = arena.data() + packed.weightOffset + panel * panelRows * packed.cols;
+                for (Index k = 0; k < packed.cols; ++k) {
+                    for (Index r = 0; r < panelRows and panel * panelRows + r < packed.rows; ++r) {
+                        dest[k * panelRows + r] = layer.weights(panel * panelRows + r, k);
+                    }
+                }
+            }
+            std::copy(layer.bias.begin(), layer.bias.end(), arena.begin() + static_cast<std::ptrdiff_t>(packed.biasOffset));
+        }
+    }
+
+    //output must hold numOutputs() values, input numInputs(); safe to call concurrently
+    void predict(const T* input, T* output) const {
+        if (maxWidth <= maxStackWidth) {
+            alignas(64) std::array<T, maxStackWidth> front, back;
+            run(input, output, front.data(), back.data());
+        }
+        else {
+            std::vector<T, aligned_allocator<T>> front(maxWidth), back(maxWidth);
+            run(input, output, front.data(), back.data());
+        }
+    }
+
+    std::vector<T> predict(const std::vector<T>& input) const {
+        if (input.size() != numInputs()) {
+            throw std::invalid_argument("Input dimensionality " + std::to_string(input.size()) + " does not match model input dimensions " + std::to_string(numInputs()));
+        }
+        std::vector<T> output(numOutputs());
+        predict(input.data(), output.data());
+        return output;
+    }
+
+    //each column of inputs is one sample, run one after the other
+    MatrixX<T> predictBatch(const Ref<const MatrixX<T>>& inputs) const {
+        if (inputs.rows() != numInputs()) {
+            throw std::invalid_argument("Input dimensionality " + std::to_string(inputs.rows()) + " does not match model input dimensions " + std::to_string(numInputs()));
+        }
+        MatrixX<T> result(numOutputs(), inputs.cols());
+        for (Index j = 0; j < inputs.cols(); ++j) {
+            predict(inputs.col(j).data(), result.col(j).data());
+        }
+        return result;
+    }
+
+    size_t numInputs() const {
+        return inputSize;
+    }
+
+    size_t numOutputs() const {
+        return layers.back().rows;
+    }
+
+private:
+    struct PackedLayer {
+        Index rows, cols, panelRows, panels;
+        ACTIVATION activation;
+        size_t weightOffset, biasOffset;
+    };
+
+    void run(const T* input, T* output, T* front, T* back) const {
+        const T* in = input;
+        for (size_t l = 0; l < layers.size(); ++l) {
+            T* out = (l + 1 == layers.size() ? output : (l % 2 ? back : front));
+            if (layers[l].panelRows == widePanelRows) {
+                propagate<widePanelRows>(layers[l], in, out);
+            }
+            else {
+                propagate<narrowPanelRows>(layers[l], in, out);
+            }
+            in = out;
+        }
+    }
+
+    template <Index panelRows>
+    void propagate(const PackedLayer& layer, const T* __restrict in, T* __restrict out) const {
+        using Panel = Array<T, panelRows, 1>;
+
+        const T* weights = arena.data() + layer.weightOffset;
+        const T* bias = arena.data() + layer.biasOffset;
+
+        for (Index panel = 0; panel < layer.panels; ++panel) {
+            //two accumulators over alternating columns hide the multiply-add latency
+            Panel acc = Map<const Panel, Aligned>(bias + panel * panelRows), odd = Panel::Zero();
+
+            const T* w = weights + panel * panelRows * layer.cols;
+            Index k = 0;
+            for (; k + 1 < layer.cols; k += 2) {
+                acc += Map<const Panel, Aligned>(w + k * panelRows) * in[k];
+                odd += Map<const Panel, Aligned>(w + (k + 1) * panelRows) * in[k + 1];
+            }
+            if (k < layer.cols) {
+                acc += Map<const Panel, Aligned>(w + k * panelRows) * in[k];
+            }
+            acc += odd;
+
+            activate(acc, layer.activation);
+
+            const Index valid = std::min(panelRows, layer.rows - panel * panelRows);
+            std::copy(acc.data(), acc.data() + valid, out + panel * panelRows);
+        }
+    }
+
+    template <typename Panel>
+    static void activate(Panel& values, ACTIVATION activation) {
+        switch (activation) {
+            case ACTIVATION::SIGMOID:
+                values = (T(1) + (-values).exp()).inverse();
+                break;
+            case ACTIVATION::RELU:
+                values = values.max(T(0));
+                break;
+            case ACTIVATION::TANH:
+                values = values.tanh();
+                break;
+            case ACTIVATION::NONE:
+                break;
+        }
+    }
+
+    std::vector<T, aligned_allocator<T>> arena;
+    std::vector<PackedLayer> layers;
+    size_t inputSize;
+    Index maxWidth;
+};
+
+
+#endif //PERCEPTRON_COMPILEDPERCEPTRON_H
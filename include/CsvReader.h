@@ -0,0 +1,250 @@
+#ifndef PERCEPTRON_CSVREADER_H
+#define PERCEPTRON_CSVREADER_H
+
+#include "defs.h"
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <exception>
+#include <fcntl.h>
+#include <span>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+
+/*
+ * Parallel reader for numeric csv files (e.g. timestamp,price or price,signal).
+ *
+ * The file is memory mapped and split into newline aligned chunks, one per
+ * thread. A first pass counts the rows of every chunk so that each thread
+ * knows where its rows land; the second pass parses straight into the
+ * caller's column vectors with std::from_chars, without building strings.
+ *
+ * A first line without a single numeric field is treated as a header and
+ * skipped, empty lines are ignored, and every other line must hold exactly
+ * one value per column. Spaces and tabs around fields are allowed, as
+ * they were when rows were parsed with std::stod.
+ */
+template <Scalar T>
+class CsvReader {
+public:
+    explicit CsvReader(const fs::path& path)
+    : path(path) {
+        const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            throw std::invalid_argument("Could not open data file " + path.string());
+        }
+
+        struct stat info{};
+        if (::fstat(fd, &info) < 0) {
+            ::close(fd);
+            throw std::runtime_error("Could not stat data file " + path.string());
+        }
+        length = static_cast<size_t>(info.st_size);
+
+        if (length) {
+            void* mapping = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapping == MAP_FAILED) {
+                ::close(fd);
+                throw std::runtime_error("Could not map data file " + path.string());
+            }
+            data = static_cast<const char*>(mapping);
+            ::madvise(mapping, length, MADV_SEQUENTIAL);
+        }
+        ::close(fd);
+    }
+
+    CsvReader(const CsvReader&) = delete;
+    CsvReader& operator=(const CsvReader&) = delete;
+
+    ~CsvReader() {
+        if (data) {
+            ::munmap(const_cast<char*>(data), length);
+        }
+    }
+
+    //replaces the contents of columns with the file's columns, in order
+    void read(std::span<std::vector<T>* const> columns, size_t numThreads = std::thread::hardware_concurrency()) const {
+        if (columns.empty()) {
+            throw std::invalid_argument("No columns requested from " + path.string());
+        }
+
+        const char* begin = data;
+        const char* const end = data + length;
+        size_t firstLine = 1;
+        if (begin != end and isHeader(begin, trim(begin, lineEnd(begin, end)))) {
+            begin = nextLine(begin, end);
+            ++firstLine;
+        }
+
+        const auto chunks = split(begin, end, std::max<size_t>(numThreads, 1));
+
+        //rows and line numbers at which every chunk starts, the latter only for error messages
+        std::vector<size_t> offsets(chunks.size() + 1, 0), lines(chunks.size() + 1, 0);
+        lines.front() = firstLine;
+        parallelFor(chunks.size(), [&](size_t i) {
+            std::tie(offsets[i + 1], lines[i + 1]) = countRows(chunks[i].first, chunks[i].second);
+        });
+        for (size_t i = 0; i < chunks.size(); ++i) {
+            offsets[i + 1] += offsets[i];
+            lines[i + 1] += lines[i];
+        }
+
+        for (auto* column : columns) {
+            column->resize(offsets.back());
+        }
+
+        parallelFor(chunks.size(), [&](size_t i) {
+            parseRows(chunks[i].first, chunks[i].second, columns, offsets[i], offsets[i + 1], lines[i]);
+        });
+    }
+
+    void read(std::initializer_list<std::vector<T>*> columns, size_t numThreads = std::thread::hardware_concurrency()) const {
+        read(std::span<std::vector<T>* const>{columns.begin(), columns.size()}, numThreads);
+    }
+
+private:
+    using Chunk = std::pair<const char*, const char*>;
+
+    static const char* lineEnd(const char* line, const char* end) {
+        const auto* newline = static_cast<const char*>(std::memchr(line, '\n', static_cast<size_t>(end - line)));
+        return newline ? newline : end;
+    }
+
+    static const char* nextLine(const char* line, const char* end) {
+        const char* stop = lineEnd(line, end);
+        return stop == end ? end : stop + 1;
+    }
+
+    static bool isBlank(char c) {
+        return c == ' ' or c == '\t';
+    }
+
+    static const char* skipBlanks(const char* p, const char* stop) {
+        return std::find_if_not(p, stop, isBlank);
+    }
+
+    //strips trailing blanks and a carriage return, so CRLF files parse and whitespace-only lines count as empty
+    static const char* trim(const char* line, const char* stop) {
+        while (stop > line and (stop[-1] == '\r' or isBlank(stop[-1]))) {
+            --stop;
+        }
+        return stop;
+    }
+
+    static std::vector<Chunk> split(const char* begin, const char* end, size_t count) {
+        std::vector<Chunk> chunks;
+        const size_t size = static_cast<size_t>(end - begin);
+        const char* start = begin;
+        for (size_t i = 1; i <= count and start != end; ++i) {
+            const char* stop = (i == count ? end : std::max(start, nextLine(begin + i * size / count, end)));
+            if (stop != start) {
+                chunks.emplace_back(start, stop);
+                start = stop;
+            }
+        }
+        return chunks;
+    }
+
+    //non-empty rows and lines, blank ones included
+    static std::pair<size_t, size_t> countRows(const char* line, const char* end) {
+        size_t rows = 0, lines = 0;
+        while (line != end) {
+            const char* stop = lineEnd(line, end);
+            rows += trim(line, stop) != line;
+            ++lines;
+            line = (stop == end ? end : stop + 1);
+        }
+        return {rows, lines};
+    }
+
+    //a line none of whose fields starts with a number, so a malformed data row is still reported
+    static bool isHeader(const char* p, const char* stop) {
+        while (true) {
+            const char* field = std::find(p, stop, ',');
+            T value;
+            if (std::from_chars(skipBlanks(p, field), field, value).ec == std::errc{}) {
+                return false;
+            }
+            if (field == stop) {
+                return true;
+            }
+            p = field + 1;
+        }
+    }
+
+    static bool parseRow(const char* p, const char* stop, T* values, size_t numColumns) {
+        for (size_t c = 0; c < numColumns; ++c) {
+            const auto [next, ec] = std::from_chars(skipBlanks(p, stop), stop, values[c]);
+            if (ec != std::errc{}) {
+                return false;
+            }
+            p = skipBlanks(next, stop);
+            if (c + 1 < numColumns) {
+                if (p == stop or *p != ',') return false;
+                ++p;
+            }
+        }
+        return p == stop;
+    }
+
+    void parseRows(const char* line, const char* end, std::span<std::vector<T>* const> columns, size_t firstRow, size_t lastRow, size_t lineNumber) const {
+        const size_t numColumns = columns.size();
+        std::vector<T> values(numColumns);
+        size_t row = firstRow;
+
+        while (line != end) {
+            const char* stop = lineEnd(line, end);
+            const char* content = trim(line, stop);
+            if (content != line) {
+                if (row == lastRow or not parseRow(line, content, values.data(), numColumns)) {
+                    throw std::invalid_argument(
+                            "Malformed line " + std::to_string(lineNumber) + " in " + path.string()
+                            + ", expected " + std::to_string(numColumns) + " numeric columns: "
+                            + std::string{line, content}
+                    );
+                }
+                for (size_t c = 0; c < numColumns; ++c) {
+                    (*columns[c])[row] = values[c];
+                }
+                ++row;
+            }
+            line = (stop == end ? end : stop + 1);
+            ++lineNumber;
+        }
+
+        if (row != lastRow) {
+            throw std::runtime_error("Row count mismatch while reading " + path.string());
+        }
+    }
+
+    static void parallelFor(size_t count, const auto& fn) {
+        std::vector<std::exception_ptr> errors(count);
+        {
+            std::vector<std::jthread> workers;
+            workers.reserve(count);
+            for (size_t i = 0; i < count; ++i) {
+                workers.emplace_back([&, i]() {
+                    try {
+                        fn(i);
+                    }
+                    catch (...) {
+                        errors[i] = std::current_exception();
+                    }
+                });
+            }
+        }
+        for (const auto& error : errors) {
+            if (error) std::rethrow_exception(error);
+        }
+    }
+
+    const fs::path path;
+    const char* data = nullptr;
+    size_t length = 0;
+};
+
+
+#endif //PERCEPTRON_CSVREADER_H
@@ -0,0 +1,198 @@
+#ifndef PERCEPTRON_DATAPARALLEL_H
+#define PERCEPTRON_DATAPARALLEL_H
+
+#include "defs.h"
+#include "Perceptron.h"
+#include "Collective.h"
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+
+
+/*
+ * Synchronous data-parallel training: every worker holds a full replica of
+ * the model, computes gradients on its own batch and the gradients are summed
+ * over all workers with a ring all-reduce before every worker applies the
+ * same update, which keeps the replicas identical.
+ *
+ * Gradients are grouped into buckets of at most bucketBytes, filled from the
+ * last layer backwards in the order the backward pass finishes them; a layer
+ * that is larger than bucketBytes on its own gets a bucket to itself. A
+ * bucket is handed to a communication thread as soon as its last layer is
+ * done, so reducing the tail layers overlaps with the backward pass of the
+ * wide first layer.
+ */
+template <Scalar T>
+class DataParallelTrainer {
+public:
+    DataParallelTrainer(Perceptron<T>& model, Transport& transport, size_t bucketBytes = size_t{1} << 20)
+    : model(model), transport(transport), communicator([this](std::stop_token token) { communicate(token); }) {
+        typename Perceptron<T>::Snapshot shape;
+        model.snapshot(shape);
+
+        layerBucket.resize(shape.weights.size());
+        for (size_t l = shape.weights.size(); l-- > 0;) {
+            const size_t layerSize = static_cast<size_t>(shape.weights[l].size() + shape.biases[l].size());
+            if (buckets.empty() or (not buckets.back().data.empty() and (buckets.back().data.size() + layerSize) * sizeof(T) > bucketBytes)) {
+                buckets.emplace_back();
+            }
+            auto& bucket = buckets.back();
+            bucket.layers.push_back(l);
+            bucket.data.resize(bucket.data.size() + layerSize);
+            layerBucket[l] = buckets.size() - 1;
+        }
+    }
+
+    DataParallelTrainer(const DataParallelTrainer&) = delete;
+    DataParallelTrainer& operator=(const DataParallelTrainer&) = delete;
+
+    ~DataParallelTrainer() {
+        {
+            std::lock_guard lock{mutex};
+            communicator.request_stop();
+        }
+        queued.notify_all();
+    }
+
+    //makes every replica equal to the one on rank 0
+    void broadcastParameters() {
+        typename Perceptron<T>::Snapshot parameters;
+        model.snapshot(parameters);
+
+        for (size_t l = 0; l < parameters.weights.size(); ++l) {
+            if (transport.rank() != 0) {
+                parameters.weights[l].setZero();
+                parameters.biases[l].setZero();
+            }
+            ringAllReduce<T>(transport, {parameters.weights[l].data(), static_cast<size_t>(parameters.weights[l].size())});
+            ringAllReduce<T>(transport, {parameters.biases[l].data(), static_cast<size_t>(parameters.biases[l].size())});
+        }
+
+        model.restore(parameters);
+    }
+
+    /*
+     * One synchronous step on this worker's batch. The update applied is the
+     * gradient summed over the local batch and averaged over workers, i.e. the
+     * same step size as one single-process epoch of per-sample updates.
+     * Returns the mean per-sample error over all workers' batches.
+     */
+    double step(const Ref<const MatrixX<T>>& inputs, const Ref<const MatrixX<T>>& targets, T learningRate) {
+        for (auto& bucket : buckets) {
+            bucket.remaining = bucket.layers.size();
+        }
+        {
+            std::lock_guard lock{mutex};
+            reduced = 0;
+        }
+
+        const double error = model.computeGradients(inputs, targets, gradients, [this](size_t layer) {
+            auto& bucket = buckets[layerBucket[layer]];
+            if (--bucket.remaining == 0) {
+                pack(bucket);
+                {
+                    std::lock_guard lock{mutex};
+                    pending.push_back(layerBucket[layer]);
+                }
+                queued.notify_one();
+            }
+        });
+
+        {
+            std::unique_lock lock{mutex};
+            done.wait(lock, [this]() { return failure or reduced == buckets.size(); });
+            if (failure) {
+                std::rethrow_exception(std::exchange(failure, nullptr));
+            }
+        }
+
+        const T scale = T(1) / static_cast<T>(transport.size());
+        for (auto& bucket : buckets) {
+            unpack(bucket, scale);
+        }
+        model.applyGradients(gradients, learningRate);
+
+        double totals[2] = {error, static_cast<double>(inputs.cols())};
+        ringAllReduce<double>(transport, totals);
+        return totals[0] / totals[1];
+    }
+
+    [[nodiscard]] size_t numBuckets() const {
+        return buckets.size();
+    }
+
+private:
+    struct Bucket {
+        std::vector<size_t> layers; //in the order the backward pass finishes them
+        std::vector<T> data;
+        size_t remaining = 0;
+    };
+
+    void pack(Bucket& bucket) {
+        T* p = bucket.data.data();
+        for (const size_t l : bucket.layers) {
+            p = std::copy(gradients.weights[l].data(), gradients.weights[l].data() + gradients.weights[l].size(), p);
+            p = std::copy(gradients.biases[l].data(), gradients.biases[l].data() + gradients.biases[l].size(), p);
+        }
+    }
+
+    void unpack(const Bucket& bucket, T scale) {
+        const T* p = bucket.data.data();
+        for (const size_t l : bucket.layers) {
+            auto& weights = gradients.weights[l];
+            auto& biases = gradients.biases[l];
+            weights = scale * Map<const MatrixX<T>>(p, weights.rows(), weights.cols());
+            p += weights.size();
+            biases = scale * Map<const VectorX<T>>(p, biases.size());
+            p += biases.size();
+        }
+    }
+
+    void communicate(std::stop_token token) {
+        while (true) {
+            size_t index;
+            {
+                std::unique_lock lock{mutex};
+                queued.wait(lock, [&]() { return token.stop_requested() or not pending.empty(); });
+                if (pending.empty()) {
+                    return;
+                }
+                index = pending.front();
+                pending.erase(pending.begin());
+            }
+
+            try {
+                ringAllReduce<T>(transport, buckets[index].data);
+            }
+            catch (...) {
+                std::lock_guard lock{mutex};
+                failure = std::current_exception();
+            }
+
+            {
+                std::lock_guard lock{mutex};
+                ++reduced;
+            }
+            done.notify_all();
+        }
+    }
+
+    Perceptron<T>& model;
+    Transport& transport;
+
+    typename Perceptron<T>::Gradients gradients;
+    std::vector<Bucket> buckets;
+    std::vector<size_t> layerBucket;
+
+    std::mutex mutex;
+    std::condition_variable queued, done;
+    std::vector<size_t> pending;
+    size_t reduced = 0;
+    std::exception_ptr failure;
+
+    std::jthread communicator;
+};
+
+
+#endif //PERCEPTRON_DATAPARALLEL_H
@@ -0,0 +1,192 @@
+#ifndef PERCEPTRON_INFERENCESERVER_H
+#define PERCEPTRON_INFERENCESERVER_H
+
+#include "defs.h"
+#include "RequestBatcher.h"
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <list>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+
+/*
+ * Unix domain stream socket protocol, native byte order:
+ *
+ * request frame:
+ *      4 bytes -> number of input values n, 0 requests the server statistics
+ *      sizeof(T) * n bytes -> input values
+ *
+ * response frame:
+ *      4 bytes -> status, 0 for success, 1 for error
+ *      4 bytes -> size of payload in bytes
+ *      payload -> output values on success, UTF-8 json for statistics, message on error
+ *
+ * A connection may send any number of requests, each one is answered before
+ * the next is read. Concurrent clients should use separate connections.
+ */
+template <Scalar T>
+class InferenceServer {
+public:
+    InferenceServer(RequestBatcher<T>& batcher, fs::path socketPath)
+    : batcher(batcher), socketPath(std::move(socketPath)) {
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        if (this->socketPath.string().size() >= sizeof(address.sun_path)) {
+            throw std::invalid_argument("Socket path too long: " + this->socketPath.string());
+        }
+        std::strcpy(address.sun_path, this->socketPath.c_str());
+
+        //a socket left behind by an earlier server is replaced, anything else at that path is not ours to delete
+        const auto existing = fs::symlink_status(this->socketPath).type();
+        if (existing == fs::file_type::socket) {
+            ::unlink(address.sun_path);
+        }
+        else if (existing != fs::file_type::not_found) {
+            throw std::invalid_argument("Not replacing " + this->socketPath.string() + ", it exists and is not a socket");
+        }
+
+        listenFd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (listenFd < 0) {
+            throw std::runtime_error(std::string{"Could not create socket: "} + std::strerror(errno));
+        }
+
+        if (::bind(listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 or ::listen(listenFd, SOMAXCONN) < 0) {
+            const std::string reason = std::strerror(errno);
+            ::close(listenFd);
+            throw std::runtime_error("Could not listen on " + this->socketPath.string() + ": " + reason);
+        }
+    }
+
+    InferenceServer(const InferenceServer&) = delete;
+    InferenceServer& operator=(const InferenceServer&) = delete;
+
+    ~InferenceServer() {
+        connections.clear(); //joins every connection thread
+        ::close(listenFd);
+        std::error_code ignored;
+        if (fs::symlink_status(socketPath, ignored).type() == fs::file_type::socket) {
+            ::unlink(socketPath.c_str());
+        }
+    }
+
+    //accepts connections until stop is set, checking it every pollMillis
+    void serve(const std::atomic<bool>& stop, int pollMillis = 200) {
+        while (not stop) {
+            pollfd listener{listenFd, POLLIN, 0};
+            if (::poll(&listener, 1, pollMillis) <= 0) {
+                continue;
+            }
+
+            const int fd = ::accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (fd < 0) {
+                continue;
+            }
+
+            std::erase_if(connections, [](const Connection& c) { return c.done->load(); });
+            auto done = std::make_shared<std::atomic<bool>>(false);
+            connections.push_back({done, std::jthread{[this, fd, done, pollMillis](std::stop_token token) {
+                handle(fd, token, pollMillis);
+                ::close(fd);
+                *done = true;
+            }}});
+        }
+    }
+
+private:
+    enum Status : uint32_t { SUCCESS = 0, FAILURE = 1 };
+
+    struct Connection {
+        std::shared_ptr<std::atomic<bool>> done;
+        std::jthread thread;
+    };
+
+    void handle(int fd, std::stop_token token, int pollMillis) {
+        while (not token.stop_requested()) {
+            uint32_t count;
+            if (not readFully(fd, &count, sizeof(count), token, pollMillis)) {
+                return;
+            }
+
+            if (count == 0) {
+                const std::string text = batcher.stats().dump();
+                if (not respond(fd, SUCCESS, text.data(), text.size(), token, pollMillis)) return;
+                continue;
+            }
+
+            if (count != batcher.numInputs()) {
+                //the payload cannot be trusted to be skippable, drop the connection after answering
+                const std::string message = "Input dimensionality " + std::to_string(count) + " does not match model input dimensions " + std::to_string(batcher.numInputs());
+                respond(fd, FAILURE, message.data(), message.size(), token, pollMillis);
+                return;
+            }
+
+            std::vector<T> input(count);
+            if (not readFully(fd, input.data(), count * sizeof(T), token, pollMillis)) {
+                return;
+            }
+
+            try {
+                const std::vector<T> output = batcher.submit(std::move(input)).get();
+                if (not respond(fd, SUCCESS, output.data(), output.size() * sizeof(T), token, pollMillis)) return;
+            }
+            catch (std::exception& e) {
+                const std::string message = e.what();
+                if (not respond(fd, FAILURE, message.data(), message.size(), token, pollMillis)) return;
+            }
+        }
+    }
+
+    static bool respond(int fd, Status status, const void* payload, size_t size, std::stop_token token, int pollMillis) {
+        const uint32_t header[2] = {status, static_cast<uint32_t>(size)};
+        return writeFully(fd, header, sizeof(header), token, pollMillis) and writeFully(fd, payload, size, token, pollMillis);
+    }
+
+    //waits for fd to become ready for events, false once a stop is requested; keeps a stalled client from blocking shutdown
+    static bool waitFor(int fd, short events, std::stop_token token, int pollMillis) {
+        while (not token.stop_requested()) {
+            pollfd client{fd, events, 0};
+            if (::poll(&client, 1, pollMillis) > 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static bool readFully(int fd, void* buffer, size_t size, std::stop_token token, int pollMillis) {
+        auto* bytes = static_cast<char*>(buffer);
+        while (size) {
+            if (not waitFor(fd, POLLIN, token, pollMillis)) return false;
+            const ssize_t n = ::recv(fd, bytes, size, 0);
+            if (n < 0 and errno == EINTR) continue;
+            if (n <= 0) return false;
+            bytes += n;
+            size -= static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    static bool writeFully(int fd, const void* buffer, size_t size, std::stop_token token, int pollMillis) {
+        const auto* bytes = static_cast<const char*>(buffer);
+        while (size) {
+            if (not waitFor(fd, POLLOUT, token, pollMillis)) return false;
+            const ssize_t n = ::send(fd, bytes, size, MSG_NOSIGNAL);
+            if (n < 0 and errno == EINTR) continue;
+            if (n <= 0) return false;
+            bytes += n;
+            size -= static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    RequestBatcher<T>& batcher;
+    const fs::path socketPath;
+    int listenFd;
+    std::list<Connection> connections;
+};
+
+
+#endif //PERCEPTRON_INFERENCESERVER_H
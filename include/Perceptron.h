@@ -11,13 +11,18 @@
 #include <random>
 #include "writematrix.h"
 #include "TrainingParams.h"
-
+#include "CompiledPerceptron.h"
+#include <memory>
 
 template <Scalar T>
 class Perceptron {
 public:
 
     std::vector<T> predict(std::vector<T> input) {
+        if (compiled) {
+            return compiled->predict(input);
+        }
+
         VectorX<T> result = Map<VectorX<T>, Unaligned>(input.data(), input.size());
 
         for (auto& layer : layers) {
@@ -27,6 +32,44 @@ public:
         return {result.begin(), result.end()};
     }
 
+    //each column of inputs is one sample; does not touch the per-layer training buffers, so it is safe to call concurrently
+    MatrixX<T> predictBatch(const Ref<const MatrixX<T>>& inputs) const {
+        if (inputs.rows() != this->numInputs()) {
+            throw std::invalid_argument("Input dimensionality " + std::to_string(inputs.rows()) + " does not match model input dimensions " + std::to_string(this->inputSize));
+        }
+
+        if (compiled and inputs.cols() <= compiledBatchLimit) {
+            return compiled->predictBatch(inputs);
+        }
+
+        MatrixX<T> result = layers.front().propagateBatch(inputs);
+        for (auto layer = layers.begin() + 1; layer < layers.end(); ++layer) {
+            result = layer->propagateBatch(result);
+        }
+        return result;
+    }
+
+    //batches of up to this many samples run through the packed copy made by compile(), larger ones through eigen's matrix products
+    static constexpr Index compiledBatchLimit = 4;
+
+    /*
+     * Packs the current parameters for low-latency inference, see
+     * CompiledPerceptron. predict and small predictBatch calls use the packed
+     * copy until the parameters change, which drops it again.
+     */
+    void compile() {
+        compiled = std::make_shared<const CompiledPerceptron<T>>(packed());
+    }
+
+    //inference-only copy of the current parameters in the packed layout, independent of this model
+    [[nodiscard]] CompiledPerceptron<T> packed() const {
+        return CompiledPerceptron<T>{numInputs(), layers};
+    }
+
+    [[nodiscard]] bool isCompiled() const {
+        return compiled != nullptr;
+    }
+
     double updateWeights(VectorX<T>&& input, VectorX<T>&& targetOut, T learningRate = 1e-5) {
         if (input.size() != this->numInputs()) {
             throw std::invalid_argument("Input dimensionality " + std::to_string(input.size()) + " does not match model input dimensions " + std::to_string(this->inputSize));
@@ -35,6 +78,8 @@ public:
             throw std::invalid_argument("Input dimensionality " + std::to_string(input.size()) + " does not match model input dimensions " + std::to_string(this->inputSize));
         }
 
+        compiled.reset();
+
         for (auto& layer : layers) {
             input = layer.propagate(input);
         }
@@ -65,6 +110,61 @@ public:
         return updateWeights(std::move(input), std::move(targetOut), learningRate);
     }
 
+    //summed update direction over a batch, laid out like the model parameters; applying it with a positive learning rate lowers the error
+    struct Gradients {
+        std::vector<MatrixX<T>> weights;
+        std::vector<VectorX<T>> biases;
+    };
+
+    /*
+     * Forward and backward pass over a batch (one sample per column) without
+     * touching the parameters. Layers are finished last to first, and
+     * onLayer(index) is called as soon as a layer's gradients are complete so
+     * that callers can start communicating them while the rest of the pass
+     * runs. Returns the summed error of the batch.
+     */
+    double computeGradients(const Ref<const MatrixX<T>>& inputs, const Ref<const MatrixX<T>>& targets, Gradients& out, const auto& onLayer) const {
+        if (inputs.rows() != this->numInputs() or targets.rows() != this->numOutputs() or inputs.cols() != targets.cols()) {
+            throw std::invalid_argument("Batch of " + std::to_string(inputs.rows()) + "x" + std::to_string(inputs.cols()) + " inputs and " + std::to_string(targets.rows()) + "x" + std::to_string(targets.cols()) + " targets does not match model dimensions");
+        }
+
+        std::vector<MatrixX<T>> activations(layers.size() + 1);
+        activations.front() = inputs;
+        for (size_t l = 0; l < layers.size(); ++l) {
+            activations[l + 1] = layers[l].propagateBatch(activations[l]);
+        }
+
+        MatrixX<T> outputError = targets - activations.back();
+        const double error = 0.5 * static_cast<double>(outputError.squaredNorm());
+
+        out.weights.resize(layers.size());
+        out.biases.resize(layers.size());
+
+        for (size_t l = layers.size(); l-- > 0;) {
+            MatrixX<T> delta = activations[l + 1];
+            layers[l].activationDxInPlace(delta);
+            delta = delta.cwiseProduct(outputError);
+
+            out.weights[l].noalias() = delta * activations[l].transpose();
+            out.biases[l] = delta.rowwise().sum();
+            onLayer(l);
+
+            if (l > 0) {
+                outputError.noalias() = layers[l].weights.transpose() * delta;
+            }
+        }
+
+        return error;
+    }
+
+    void applyGradients(const Gradients& gradients, T learningRate) {
+        compiled.reset();
+        for (size_t l = 0; l < layers.size(); ++l) {
+            layers[l].weights += learningRate * gradients.weights[l];
+            layers[l].bias += learningRate * gradients.biases[l];
+        }
+    }
+
     static json readAndValidateModelJson(const fs::path& filename) {
         json data;
         if (std::ifstream file(filename); file) {
@@ -96,29 +196,53 @@ public:
         return fromJson(readAndValidateModelJson(path));
     }
 
-    void saveToFolder(const fs::path& folderName) {
-        if (not fs::exists(folderName)) {
-            fs::create_directory(folderName);
+    //copy of the model parameters that can be written out while the live model keeps training
+    struct Snapshot {
+        json description;
+        std::vector<MatrixX<T>> weights;
+        std::vector<VectorX<T>> biases;
+
+        void saveToFolder(const fs::path& folderName) const {
+            writeFolder(folderName, description, weights, biases);
         }
-        auto jsonPath = folderName / "model.json";
+    };
 
-        if (std::ofstream modelFile{jsonPath}) {
-            json jsonData{};
-            jsonData["inputs"] = this->numInputs();
-            jsonData["layers"] = json::array();
+    //reuses the buffers already held by out, so repeated snapshots of the same model do not allocate
+    void snapshot(Snapshot& out) const {
+        out.description = describe();
+        out.weights.resize(layers.size());
+        out.biases.resize(layers.size());
 
-            for (const auto& layer : layers) {
-                jsonData["layers"].push_back({{"activation", layer.getStrActivationFunction()},{"size", layer.size()}});
-            }
-            modelFile << jsonData;
-        } else throw std::runtime_error("Could not create file " + jsonPath.string());
+        for (size_t i = 0; i < layers.size(); ++i) {
+            out.weights[i] = layers[i].weights;
+            out.biases[i] = layers[i].bias;
+        }
+    }
 
-        for (auto layer = layers.begin(); layer < layers.end(); ++layer) {
-            writeMatrix(layer->weights, folderName / fs::path("weights" + std::to_string(layer - layers.begin()) + ".bin"));
-            writeMatrix(layer->bias, folderName / fs::path("bias" + std::to_string(layer - layers.begin()) + ".bin"));
+    //takes the parameters of a snapshot of a model with the same shape
+    void restore(const Snapshot& snapshot) {
+        if (snapshot.weights.size() != layers.size()) {
+            throw std::invalid_argument("Snapshot does not match model shape");
+        }
+        compiled.reset();
+        for (size_t i = 0; i < layers.size(); ++i) {
+            if (snapshot.weights[i].rows() != layers[i].weights.rows() or snapshot.weights[i].cols() != layers[i].weights.cols() or snapshot.biases[i].size() != layers[i].bias.size()) {
+                throw std::invalid_argument("Snapshot does not match model shape");
+            }
+            layers[i].weights = snapshot.weights[i];
+            layers[i].bias = snapshot.biases[i];
         }
     }
 
+    void saveToFolder(const fs::path& folderName) const {
+        writeFolder(
+                folderName,
+                describe(),
+                layers | views::transform(&PerceptronLayer::weights),
+                layers | views::transform(&PerceptronLayer::bias)
+        );
+    }
+
     static Perceptron<T> readFromFolder(const fs::path& path) {
         if (not fs::exists(path)) {
             throw std::invalid_argument("Could not find folder " + path.string());
@@ -151,16 +275,27 @@ public:
         return stream;
     }
 
-    size_t numInputs() {
+    size_t numInputs() const {
         return inputSize;
     }
 
-    size_t numOutputs() {
+    size_t numOutputs() const {
         return layers.back().weights.rows();
     }
 
-private:
+    //model.json contents for this network
+    json describe() const {
+        json jsonData{};
+        jsonData["inputs"] = this->numInputs();
+        jsonData["layers"] = json::array();
 
+        for (const auto& layer : layers) {
+            jsonData["layers"].push_back({{"activation", layer.getStrActivationFunction()},{"size", layer.size()}});
+        }
+        return jsonData;
+    }
+
+private:
     explicit Perceptron(const std::vector<size_t>& shape, bool lastLayerHasActivation = false, std::vector<ACTIVATION> layerFuncs = {}) {
         srand(
                 []() -> unsigned {
@@ -195,9 +330,30 @@ private:
     explicit Perceptron(size_t inputShape)
     : inputSize(inputShape) {}
 
+    static void writeFolder(const fs::path& folderName, const json& description, const auto& weights, const auto& biases) {
+        if (not fs::exists(folderName)) {
+            fs::create_directory(folderName);
+        }
+        auto jsonPath = folderName / "model.json";
+
+        if (std::ofstream modelFile{jsonPath}) {
+            modelFile << description;
+        } else throw std::runtime_error("Could not create file " + jsonPath.string());
+
+        for (size_t layer = 0; layer < ranges::size(weights); ++layer) {
+            writeMatrix(weights[layer], folderName / fs::path("weights" + std::to_string(layer) + ".bin"));
+            writeMatrix(biases[layer], folderName / fs::path("bias" + std::to_string(layer) + ".bin"));
+        }
+    }
+
     void addLayer(size_t width, ACTIVATION func, MatrixX<T>&& weights, VectorX<T>&& bias) {
         const auto prevLayerSize = (layers.empty() ? inputSize : layers.back().size());
+        if (weights.rows() != width or weights.cols() != prevLayerSize or bias.size() != width) {
+            throw std::invalid_argument("Stored parameters do not match layer of size " + std::to_string(width));
+        }
         layers.push_back(PerceptronLayer{width, prevLayerSize, func});
+        layers.back().weights = std::move(weights);
+        layers.back().bias = std::move(bias);
     }
 
     static Perceptron fromJson(const json& data) {
@@ -251,6 +407,49 @@ private:
             return this->output = activation(weights * in + bias);
         }
 
+        MatrixX<T> propagateBatch(const Ref<const MatrixX<T>>& in) const {
+            MatrixX<T> result = weights * in;
+            result.colwise() += bias;
+            activateInPlace(result);
+            return result;
+        }
+
+        void activateInPlace(MatrixX<T>& values) const {
+            switch (activationFuncID) {
+                case ACTIVATION::SIGMOID:
+                    values = (T(1) + (-values.array()).exp()).inverse().matrix();
+                    break;
+                case ACTIVATION::RELU:
+                    values = values.cwiseMax(T(0));
+                    break;
+                case ACTIVATION::TANH:
+                    values = values.array().tanh().matrix();
+                    break;
+                case ACTIVATION::NONE:
+                    break;
+            }
+        }
+
+        //same derivatives as activation_dx, which updateWeights also evaluates at the layer output
+        void activationDxInPlace(MatrixX<T>& values) const {
+            switch (activationFuncID) {
+                case ACTIVATION::SIGMOID: {
+                    const MatrixX<T> s = (T(1) + (-values.array()).exp()).inverse().matrix();
+                    values = s.cwiseProduct((T(1) - s.array()).matrix());
+                    break;
+                }
+                case ACTIVATION::RELU:
+                    values = (values.array() > T(0)).template cast<T>().matrix();
+                    break;
+                case ACTIVATION::TANH:
+                    values = (T(1) - values.array().tanh().square()).matrix();
+                    break;
+                case ACTIVATION::NONE:
+                    values.setOnes();
+                    break;
+            }
+        }
+
         [[nodiscard]] size_t size() const {
             return bias.size();
         }
@@ -279,7 +478,8 @@ private:
         }
 
         static VectorX<T> sigmoid_dx(const VectorX<T>& input) {
-            return sigmoid(input) * (VectorX<T>::Ones(input.size()) - sigmoid(input));
+            const VectorX<T> s = sigmoid(input);
+            return s.array() * (T(1) - s.array());
         }
 
         static VectorX<T> tanh(const VectorX<T>& input) {
@@ -358,6 +558,7 @@ private:
 
     std::vector<PerceptronLayer> layers;
     size_t inputSize;
+    std::shared_ptr<const CompiledPerceptron<T>> compiled; //never modified once built, so copies of the model can share it
 };
 
 
@@ -0,0 +1,175 @@
+#ifndef PERCEPTRON_REQUESTBATCHER_H
+#define PERCEPTRON_REQUESTBATCHER_H
+
+#include "defs.h"
+#include "Perceptron.h"
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <thread>
+
+
+/*
+ * Coalesces single predictions submitted from many threads into batched
+ * forward passes. Every worker takes the oldest pending requests once either
+ * maxBatchSize of them are queued or the oldest one has waited maxWait, so
+ * maxWait bounds the latency added by batching.
+ */
+template <Scalar T>
+class RequestBatcher {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    RequestBatcher(const Perceptron<T>& model, size_t maxBatchSize, std::chrono::microseconds maxWait, size_t numWorkers, size_t latencyWindow = 4096)
+    : model(model), maxBatchSize(std::max<size_t>(maxBatchSize, 1)), maxWait(maxWait), latencies(std::max<size_t>(latencyWindow, 1)) {
+        for (size_t i = 0; i < std::max<size_t>(numWorkers, 1); ++i) {
+            workers.emplace_back([this](std::stop_token token) { workerLoop(token); });
+        }
+    }
+
+    RequestBatcher(const RequestBatcher&) = delete;
+    RequestBatcher& operator=(const RequestBatcher&) = delete;
+
+    ~RequestBatcher() {
+        {
+            std::lock_guard lock{mutex};
+            for (auto& worker : workers) {
+                worker.request_stop();
+            }
+        }
+        pending.notify_all();
+    }
+
+    std::future<std::vector<T>> submit(std::vector<T> input) {
+        if (input.size() != model.numInputs()) {
+            throw std::invalid_argument("Input dimensionality " + std::to_string(input.size()) + " does not match model input dimensions " + std::to_string(model.numInputs()));
+        }
+
+        Request request{std::move(input), {}, Clock::now()};
+        auto result = request.result.get_future();
+        {
+            std::lock_guard lock{mutex};
+            queue.push_back(std::move(request));
+        }
+        pending.notify_one();
+        return result;
+    }
+
+    size_t numInputs() const {
+        return model.numInputs();
+    }
+
+    json stats() const {
+        std::lock_guard lock{mutex};
+
+        std::vector<double> sorted(latencies.begin(), latencies.begin() + static_cast<std::ptrdiff_t>(std::min(completed, latencies.size())));
+        ranges::sort(sorted);
+        auto percentile = [&sorted](double p) -> double {
+            return sorted.empty() ? 0 : sorted[static_cast<size_t>(p * static_cast<double>(sorted.size() - 1))];
+        };
+
+        return {
+                {"queueDepth", queue.size()},
+                {"requests", completed},
+                {"batches", batches},
+                {"meanBatchSize", batches ? static_cast<double>(completed) / static_cast<double>(batches) : 0.0},
+                {"latencyMicros", {
+                        {"p50", percentile(0.50)},
+                        {"p90", percentile(0.90)},
+                        {"p99", percentile(0.99)},
+                        {"max", sorted.empty() ? 0.0 : sorted.back()}
+                }}
+        };
+    }
+
+private:
+    struct Request {
+        std::vector<T> input;
+        std::promise<std::vector<T>> result;
+        Clock::time_point enqueued;
+    };
+
+    void workerLoop(std::stop_token token) {
+        std::vector<Request> batch;
+        batch.reserve(maxBatchSize);
+
+        while (true) {
+            {
+                std::unique_lock lock{mutex};
+                pending.wait(lock, [&]() { return token.stop_requested() or not queue.empty(); });
+                if (token.stop_requested()) {
+                    for (auto& request : queue) {
+                        request.result.set_exception(std::make_exception_ptr(std::runtime_error("Batcher shut down")));
+                    }
+                    queue.clear();
+                    return;
+                }
+
+                //hold the batch open until it is full or its oldest request is due
+                pending.wait_until(lock, queue.front().enqueued + maxWait, [&]() {
+                    return token.stop_requested() or queue.empty() or queue.size() >= maxBatchSize;
+                });
+                if (queue.empty()) {
+                    continue; //another worker took them
+                }
+
+                const size_t count = std::min(queue.size(), maxBatchSize);
+                std::move(queue.begin(), queue.begin() + static_cast<std::ptrdiff_t>(count), std::back_inserter(batch));
+                queue.erase(queue.begin(), queue.begin() + static_cast<std::ptrdiff_t>(count));
+            }
+
+            run(batch);
+            batch.clear();
+        }
+    }
+
+    void run(std::vector<Request>& batch) {
+        MatrixX<T> outputs;
+        std::exception_ptr error;
+        try {
+            MatrixX<T> inputs(model.numInputs(), batch.size());
+            for (size_t j = 0; j < batch.size(); ++j) {
+                inputs.col(static_cast<Index>(j)) = Map<const VectorX<T>>(batch[j].input.data(), static_cast<Index>(batch[j].input.size()));
+            }
+            outputs = model.predictBatch(inputs);
+        }
+        catch (...) {
+            error = std::current_exception();
+        }
+
+        for (size_t j = 0; j < batch.size(); ++j) {
+            if (error) {
+                batch[j].result.set_exception(error);
+            }
+            else {
+                const auto column = outputs.col(static_cast<Index>(j));
+                batch[j].result.set_value({column.begin(), column.end()});
+            }
+        }
+
+        const auto now = Clock::now();
+        std::lock_guard lock{mutex};
+        for (const auto& request : batch) {
+            latencies[completed++ % latencies.size()] = std::chrono::duration<double, std::micro>(now - request.enqueued).count();
+        }
+        ++batches;
+    }
+
+    const Perceptron<T>& model;
+    const size_t maxBatchSize;
+    const std::chrono::microseconds maxWait;
+
+    mutable std::mutex mutex;
+    std::condition_variable pending;
+    std::deque<Request> queue;
+
+    std::vector<double> latencies; //ring of the most recent request latencies
+    size_t completed = 0, batches = 0;
+
+    std::vector<std::jthread> workers;
+};
+
+
+#endif //PERCEPTRON_REQUESTBATCHER_H
@@ -7,38 +7,43 @@
 
 #include "defs.h"
 #include <filesystem>
+#include <random>
+#include <sstream>
 #include "Perceptron.h"
+#include "CsvReader.h"
 
 template <Scalar T>
 class TrainData {
 public:
     TrainData(const fs::path& trainCSV, size_t inputSize, size_t outputSize)
     : inputSize(inputSize), outputSize(outputSize) {
-        if (std::ifstream file{trainCSV}) {
-            std::string line{};
-            std::getline(file, line);
-            while (std::getline(file, line)) {
-                auto view = line | views::split(',');
-                std::vector<std::string> data;
-                for (const auto& str : view) {
-                    data.emplace_back(str.begin(), str.end());
-                }
-                assert(data.size() == 2);
-                inputData.push_back(std::stod(data[0]));
-                outputData.push_back(std::stod(data[1]));
-            }
-        }
-        else throw std::invalid_argument("Could not open data file " + trainCSV.string());
+        CsvReader<T>{trainCSV}.read({&inputData, &outputData});
     }
 
     std::pair<VectorX<T>, VectorX<T>> getIoPair() {
-        auto gen = std::make_unique<std::mt19937>(std::random_device{}());
-        std::uniform_int_distribution<ssize_t> dist{0, inputData.size() - static_cast<decltype(inputData.size())>(std::max(inputSize, outputSize))};
-        auto index = dist(*gen);
-        return std::make_pair(
-                Map<VectorX<T>>{&(inputData[index]), inputSize},
-                Map<VectorX<T>>{&(outputData[index + inputSize - outputSize]), outputSize}
-        );
+        return getIoPair(randomIndex());
+    }
+
+    size_t randomIndex() {
+        const size_t last = inputData.size() - std::max(inputSize, outputSize);
+        std::uniform_int_distribution<size_t> dist{shardBegin, std::min(shardEnd, last)};
+        return dist(gen);
+    }
+
+    //a seed taken from the sampler, so that generators seeded with it are reproducible from this one's state
+    uint64_t drawSeed() {
+        return gen();
+    }
+
+    //limits random samples to windows starting in this worker's share of the data and gives it its own sample sequence, derived from seed
+    void restrictToShard(size_t rank, size_t numShards, uint64_t seed) {
+        const size_t windows = inputData.size() - std::max(inputSize, outputSize) + 1;
+        if (numShards == 0 or rank >= numShards or windows < numShards) {
+            throw std::invalid_argument("Cannot split " + std::to_string(windows) + " samples into " + std::to_string(numShards) + " shards");
+        }
+        shardBegin = rank * windows / numShards;
+        shardEnd = (rank + 1) * windows / numShards - 1;
+        gen.seed(seed ^ (rank * 0x9E3779B97F4A7C15ull));
     }
 
     std::pair<VectorX<T>, VectorX<T>> getIoPair(size_t index) {
@@ -50,9 +55,37 @@ public:
         );
     }
 
+    const std::vector<T>& getInputData() const {
+        return inputData;
+    }
+
+    const std::vector<T>& getOutputData() const {
+        return outputData;
+    }
+
+    size_t size() const {
+        return inputData.size();
+    }
+
+    //the sampler state is kept as text so that it can be stored alongside a training checkpoint
+    std::string getRngState() const {
+        std::ostringstream stream;
+        stream << gen;
+        return stream.str();
+    }
+
+    void setRngState(const std::string& state) {
+        std::istringstream stream{state};
+        if (not (stream >> gen)) {
+            throw std::invalid_argument("Invalid random generator state");
+        }
+    }
+
 private:
     std::vector<T> inputData, outputData;
     const size_t inputSize, outputSize;
+    std::mt19937_64 gen{std::random_device{}()};
+    size_t shardBegin = 0, shardEnd = std::numeric_limits<size_t>::max();
 };
 
 
@@ -29,6 +29,7 @@ public:
                 batchSize = data["batchSize"].template get<size_t>();
                 threshhold = data["threshold"].template get<double>();
                 learningRate = data["learningRate"].template get<double>();
+                checkpointInterval = data.value("checkpointInterval", size_t{0});
 
             }
             catch (json::exception& e) {
@@ -54,8 +55,13 @@ public:
         return learningRate;
     }
 
+    //number of epochs between checkpoints, 0 disables checkpointing
+    size_t getCheckpointInterval() const {
+        return checkpointInterval;
+    }
+
 private:
-    size_t epochs, batchSize;
+    size_t epochs, batchSize, checkpointInterval;
     double threshhold, learningRate;
 };
 
@@ -0,0 +1,87 @@
+#include <vector>
+#include <string_view>
+#include <algorithm>
+#include <chrono>
+
+#include "Perceptron.h"
+#include "CommandLine.h"
+#include "defs.h"
+
+
+//best of reps timings of fn, in microseconds per call
+static double bestTime(size_t reps, size_t calls, const auto& fn) {
+    double best = std::numeric_limits<double>::max();
+    for (size_t rep = 0; rep < reps; ++rep) {
+        const auto start = std::chrono::steady_clock::now();
+        for (size_t call = 0; call < calls; ++call) {
+            fn();
+        }
+        best = std::min(best, std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / static_cast<double>(calls));
+    }
+    return best;
+}
+
+int main(int argc, char *argv[]) {
+
+    //parse command line args
+    std::vector<std::string_view> args{argv, argv + argc};
+    args.erase(args.begin());
+
+    auto printHelp = [](){
+        std::cout << "Usage: ./inference-bench (-l <existingModelDir> | -m <model.json>) [-n <repetitions>]\n";
+        exit(0);
+    };
+
+    static constexpr std::string_view
+    modelDirSwitch = "-l",
+    modelNameSwitch = "-m",
+    repsSwitch = "-n";
+
+    if (ranges::any_of(args, [](const auto& str) {return str.find("help") != std::string::npos;})) {
+        printHelp();
+    }
+
+    if (args.empty() or args.size() % 2) {
+        std::cerr << "Mismatched command line arguments\n";
+        printHelp();
+    }
+
+    const auto modelDir = optionalValue(args, modelDirSwitch), modelName = optionalValue(args, modelNameSwitch);
+    if (not modelDir and not modelName) {
+        std::cerr << "Missing either of -l or -m arguments\n";
+        printHelp();
+    }
+
+    //a model description alone is enough for timing, its weights are random
+    const auto eigen = (modelDir ? Perceptron<double>::readFromFolder(*modelDir) : Perceptron<double>::newFromJson(*modelName));
+    const auto packed = eigen.packed();
+
+    //-n 0 only checks that both layouts predict the same
+    const size_t reps = optionalSize(args, repsSwitch, 5);
+    //predictions are compared and timed on one thread, the packed layout is a per-call latency optimisation
+    Eigen::setNbThreads(1);
+
+    //predictBatch of a compiled model takes the packed path up to compiledBatchLimit, the larger batches show where that stops paying off
+    if (reps) {
+        std::cout << "batch\teigen us\tpacked us\tratio\n";
+    }
+    for (Index batchSize = 1; batchSize <= 4 * Perceptron<double>::compiledBatchLimit; batchSize *= 2) {
+        const MatrixX<double> inputs = MatrixX<double>::Random(static_cast<Index>(eigen.numInputs()), batchSize);
+        const MatrixX<double> expected = eigen.predictBatch(inputs), result = packed.predictBatch(inputs);
+        const double difference = (expected - result).cwiseAbs().maxCoeff();
+        if (difference > 1e-9) {
+            std::cerr << "Packed predictions differ from eigen's by " << difference << " for a batch of " << batchSize << '\n';
+            return 1;
+        }
+        if (reps == 0) {
+            continue;
+        }
+
+        const size_t calls = std::max<size_t>(1, 20'000'000 / (eigen.numInputs() * static_cast<size_t>(batchSize) * 100));
+        volatile double sink = 0;
+        const double eigenTime = bestTime(reps, calls, [&]() { sink = sink + eigen.predictBatch(inputs)(0, 0); });
+        const double packedTime = bestTime(reps, calls, [&]() { sink = sink + packed.predictBatch(inputs)(0, 0); });
+
+        std::cout << batchSize << '\t' << eigenTime << '\t' << packedTime << '\t' << packedTime / eigenTime << '\n';
+    }
+}
@@ -0,0 +1,79 @@
+#include <vector>
+#include <string_view>
+#include <algorithm>
+#include <csignal>
+
+#include "Autotune.h"
+#include "InferenceServer.h"
+#include "RequestBatcher.h"
+#include "Perceptron.h"
+#include "CommandLine.h"
+#include "defs.h"
+
+
+static std::atomic<bool> stopRequested{false};
+
+int main(int argc, char *argv[]) {
+
+    //parse command line args
+    std::vector<std::string_view> args{argv, argv + argc};
+    args.erase(args.begin());
+
+    auto printHelp = [](){
+        std::cout << "Usage: ./inference-server -l <existingModelDir> -s <socketPath> [-b <maxBatchSize> -w <maxWaitMicros> -j <workers> -a tune]\n";
+        exit(0);
+    };
+
+    static constexpr std::string_view
+    modelDirSwitch = "-l",
+    socketSwitch = "-s",
+    maxBatchSwitch = "-b",
+    maxWaitSwitch = "-w",
+    workersSwitch = "-j",
+    autotuneSwitch = "-a";
+
+    if (ranges::any_of(args, [](const auto& str) {return str.find("help") != std::string::npos;})) {
+        printHelp();
+    }
+
+    if (args.empty() or args.size() % 2) {
+        std::cerr << "Mismatched command line arguments\n";
+        printHelp();
+    }
+
+    //check mandatory switches
+    for (const auto& s : {modelDirSwitch, socketSwitch}) {
+        if (not ranges::any_of(args, [s](const auto str) {
+            return str == s;
+        })) {
+            std::cerr << "Missing switch " << s << '\n';
+            printHelp();
+        }
+    }
+
+    auto model = Perceptron<double>::readFromFolder(ranges::find(args, modelDirSwitch)[1]);
+    model.compile(); //before tuning, so that small batch sizes are timed on the packed layout they will run on
+
+    const bool retune = optionalValue(args, autotuneSwitch) == "tune";
+    const auto tuned = Autotuner<double>::resolve(model, retune);
+
+    const size_t maxBatchSize = optionalSize(args, maxBatchSwitch, tuned ? tuned->batchSize : 64);
+    const std::chrono::microseconds maxWait{optionalSize(args, maxWaitSwitch, 500)};
+    //each batch runs on the tuned number of threads, and the workers share out the remaining cores
+    const int threadsPerBatch = std::max(tuned ? tuned->inferenceThreads : 1, 1);
+    const size_t workers = optionalSize(args, workersSwitch, std::max<size_t>(std::thread::hardware_concurrency() / threadsPerBatch, 1));
+    Eigen::setNbThreads(threadsPerBatch);
+
+    RequestBatcher<double> batcher{model, maxBatchSize, maxWait, workers};
+    InferenceServer<double> server{batcher, ranges::find(args, socketSwitch)[1]};
+
+    std::signal(SIGINT, [](int) { stopRequested = true; });
+    std::signal(SIGTERM, [](int) { stopRequested = true; });
+
+    std::cout << "Serving " << model.numInputs() << " -> " << model.numOutputs() << " model on " << ranges::find(args, socketSwitch)[1]
+              << " (max batch " << maxBatchSize << ", max wait " << maxWait.count() << "us, " << workers << " workers)\n";
+
+    server.serve(stopRequested);
+
+    std::cout << batcher.stats().dump(4) << '\n';
+}
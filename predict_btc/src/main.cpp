@@ -2,6 +2,67 @@
 // Created by davidl09 on 4/13/24.
 //
 
+#include <vector>
+#include <string_view>
+#include <algorithm>
+
+#include "Autotune.h"
+#include "Backtest.h"
+#include "TrainData.h"
+#include "Perceptron.h"
+#include "CommandLine.h"
+#include "defs.h"
+
+
 int main(int argc, char *argv[]) {
 
+    //parse command line args
+    std::vector<std::string_view> args{argv, argv + argc};
+    args.erase(args.begin());
+
+    auto printHelp = [](){
+        std::cout << "Usage: ./btc-pred -l <existingModelDir> -d <data.csv> [-j <threads> -b <batchSize> -a tune]\n";
+        exit(0);
+    };
+
+    static constexpr std::string_view
+    modelDirSwitch = "-l",
+    dataFileSwitch = "-d",
+    threadsSwitch = "-j",
+    batchSizeSwitch = "-b",
+    autotuneSwitch = "-a";
+
+    if (ranges::any_of(args, [](const auto& str) {return str.find("help") != std::string::npos;})) {
+        printHelp();
+    }
+
+    if (args.empty() or args.size() % 2) {
+        std::cerr << "Mismatched command line arguments\n";
+        printHelp();
+    }
+
+    //check mandatory switches
+    for (const auto& s : {modelDirSwitch, dataFileSwitch}) {
+        if (not ranges::any_of(args, [s](const auto str) {
+            return str == s;
+        })) {
+            std::cerr << "Missing switch " << s << '\n';
+            printHelp();
+        }
+    }
+
+    auto model = Perceptron<double>::readFromFolder(ranges::find(args, modelDirSwitch)[1]);
+    model.compile(); //before tuning, so that small batch sizes are timed on the packed layout they will run on
+
+    const bool retune = optionalValue(args, autotuneSwitch) == "tune";
+    const auto tuned = Autotuner<double>::resolve(model, retune);
+
+    const size_t threads = optionalSize(args, threadsSwitch, std::max(std::thread::hardware_concurrency(), 1u));
+    const size_t batchSize = optionalSize(args, batchSizeSwitch, tuned ? tuned->batchSize : 256);
+
+    const TrainData<double> data{ranges::find(args, dataFileSwitch)[1], model.numInputs(), model.numOutputs()};
+
+    const auto report = Backtester<double>{model, data, threads, batchSize}.run();
+
+    std::cout << report;
 }
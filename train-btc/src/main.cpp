@@ -5,25 +5,33 @@
 #include <vector>
 #include <string_view>
 #include <algorithm>
+#include <cstdio>
+#include <span>
+#include <sys/wait.h>
 
 #include "TrainData.h"
 #include "Perceptron.h"
 #include "TrainingParams.h"
+#include "Checkpoint.h"
+#include "Autotune.h"
+#include "DataParallel.h"
+#include "CommandLine.h"
 #include "defs.h"
 
 #include <gnuplot-iostream.h>
 
 
+//released by the terminate handler so that a crashing worker does not leave the others waiting on it
+static ShmSegment* sharedSegment = nullptr;
+
 int main(int argc, char *argv[]) {
 
     //parse command line args
     std::vector<std::string_view> args{argv, argv + argc};
     args.erase(args.begin());
 
-    //setNbThreads(6);
-
     auto printHelp = [](){
-        std::cout << "Usage: ./train-btc -t <trainingParams.json> -d <data.csv> [-m <modelName.json> -l <existingModelDir>]\n";
+        std::cout << "Usage: ./train-btc -t <trainingParams.json> -d <data.csv> [-m <modelName.json> -l <existingModelDir> -a tune -w <localWorkers> | -r <rank> -p <host:port,...>]\n";
         exit(0);
     };
 
@@ -31,7 +39,11 @@ int main(int argc, char *argv[]) {
     trainParamsJson = "-t",
     trainDataFile = "-d",
     modelNameSwitch = "-m",
-    modelDirSwitch = "-l";
+    modelDirSwitch = "-l",
+    autotuneSwitch = "-a",
+    localWorkersSwitch = "-w",
+    rankSwitch = "-r",
+    peersSwitch = "-p";
 
     if (ranges::any_of(args, [](const auto& str) {return str.find("help") != std::string::npos;})) {
         printHelp();
@@ -70,44 +82,197 @@ int main(int argc, char *argv[]) {
         }
     }
 
+    const size_t localWorkers = std::max<size_t>(optionalSize(args, localWorkersSwitch, 1), 1);
+
+    //every process of a tcp ring has to be told which rank it is, a missing rank must not quietly turn into a second rank 0
+    if (optionalValue(args, peersSwitch) and not optionalValue(args, rankSwitch)) {
+        std::cerr << "Switch " << peersSwitch << " needs " << rankSwitch << '\n';
+        printHelp();
+    }
+
+    //tuning runs eigen's openmp thread pool in this process, and that pool does not survive the fork that starts local workers
+    const bool retune = optionalValue(args, autotuneSwitch) == "tune";
+    if (retune and localWorkers > 1) {
+        std::cerr << "Switch " << autotuneSwitch << " tune can not be combined with " << localWorkersSwitch << '\n';
+        printHelp();
+    }
+
+    const fs::path outputDir = (loadingExistModel ? modelSource : fs::path(modelSource.string().substr(0, modelSource.string().find('.'))));
+    const fs::path checkpointDir = outputDir / "checkpoints";
+
+    //an unfinished run of an existing model leaves its checkpoints behind, pick up from the newest one
+    const auto resumeFrom = (loadingExistModel ? Checkpointer<double>::latest(checkpointDir) : std::nullopt);
+
     auto model = (makingNewModel
             ? Perceptron<double>::newFromJson(modelSource)
-            : Perceptron<double>::readFromFolder(modelSource));
+            : Perceptron<double>::readFromFolder(resumeFrom.value_or(modelSource)));
+
+    TrainingParams params{ranges::find(args, trainParamsJson)[1]};
+
+    const auto tuned = (localWorkers > 1 ? std::nullopt : Autotuner<double>::resolve(model, retune, params.getBatchSize()));
+    if (localWorkers > 1) {
+        //local workers split the cores between them instead of each running the tuned thread count
+        Eigen::setNbThreads(static_cast<int>(std::max(std::thread::hardware_concurrency() / localWorkers, size_t{1})));
+    }
+    else if (ranges::find(args, peersSwitch) != args.end() and tuned and tuned->trainBatchSize == params.getBatchSize()) {
+        //only the batched gradients of the data-parallel step run multithreaded
+        Eigen::setNbThreads(tuned->trainThreads);
+    }
 
     TrainData<double> data{ranges::find(args, trainDataFile)[1], model.numInputs(), model.numOutputs()};
 
     const fs::path trainDataFilePath{std::find(args.begin(), args.end(), trainDataFile)[1]};
 
-    TrainingParams params{ranges::find(args, trainParamsJson)[1]};
+    TrainingState state{.learningRate = params.getLearningRate()};
+    if (resumeFrom) {
+        state = Checkpointer<double>::readState(*resumeFrom);
+        data.setRngState(state.rngState);
+        std::cout << "Resuming from " << resumeFrom->string() << " at epoch " << state.epoch + 1 << '\n';
+    }
+
+    //data-parallel training: -w forks local workers that talk over shared memory, -r/-p joins a tcp ring spanning several hosts.
+    //workers are forked after loading so that they share the training data pages, and before eigen starts its openmp threads
+    std::unique_ptr<ShmSegment> segment;
+    std::unique_ptr<Transport> transport;
+    std::vector<pid_t> children;
+
+    if (localWorkers > 1) {
+        segment = std::make_unique<ShmSegment>(localWorkers);
+        sharedSegment = segment.get();
+        std::set_terminate([]() {
+            if (sharedSegment) sharedSegment->abort();
+            std::abort();
+        });
+
+        //children inherit unflushed output and would print it a second time
+        std::cout.flush();
+        std::fflush(nullptr);
+
+        size_t rank = 0;
+        for (size_t r = 1; r < localWorkers; ++r) {
+            const pid_t pid = ::fork();
+            if (pid < 0) {
+                throw std::runtime_error("Could not start worker " + std::to_string(r));
+            }
+            if (pid == 0) {
+                rank = r;
+                children.clear();
+                break;
+            }
+            children.push_back(pid);
+        }
+        transport = std::make_unique<ShmTransport>(*segment, rank);
+    }
+    else if (ranges::find(args, peersSwitch) != args.end()) {
+        std::vector<std::string> peers;
+        for (const auto peer : ranges::find(args, peersSwitch)[1] | views::split(',')) {
+            peers.emplace_back(peer.begin(), peer.end());
+        }
+        transport = std::make_unique<SocketTransport>(optionalSize(args, rankSwitch, 0), peers);
+    }
+
+    const bool isRoot = not transport or transport->rank() == 0;
+
+    if (isRoot and makingNewModel) {
+        fs::remove_all(checkpointDir); //stale checkpoints of a previous model with the same name
+    }
+
+    std::unique_ptr<DataParallelTrainer<double>> trainer;
+    if (transport) {
+        //only rank 0 writes checkpoints, so the other ranks continue its run: same epoch and learning rate, samplers seeded from its generator
+        struct {
+            uint64_t epoch;
+            double learningRate;
+            uint64_t seed;
+        } start{state.epoch, state.learningRate, data.drawSeed()};
+        ringBroadcast(*transport, std::as_writable_bytes(std::span{&start, 1}));
+        state.epoch = start.epoch;
+        state.learningRate = start.learningRate;
+
+        data.restrictToShard(transport->rank(), transport->size(), start.seed);
+        trainer = std::make_unique<DataParallelTrainer<double>>(model, *transport);
+        trainer->broadcastParameters();
+    }
+
+    Checkpointer<double> checkpointer{checkpointDir};
 
     std::vector<std::pair<size_t, double>> errors;
     errors.reserve(params.getEpochs());
 
-    std::vector<decltype(data.getIoPair())> outliers;
-
-    for (int epoch = 0; epoch < params.getEpochs(); ++epoch) {
+    for (size_t epoch = state.epoch; epoch < params.getEpochs(); ++epoch) {
         double epochError = 0;
-        for (int batch = 0; batch < params.getBatchSize(); ++batch) {
-            std::pair sample = data.getIoPair(), backup = sample;
-            double error = model.updateWeights(std::move(sample.first), std::move(sample.second), params.getLearningRate());
-            if (std::round(backup.second[0])) {
-                outliers.push_back(std::move(backup));
+        if (trainer) {
+            MatrixX<double> inputs(model.numInputs(), params.getBatchSize()), targets(model.numOutputs(), params.getBatchSize());
+            for (Index batch = 0; batch < inputs.cols(); ++batch) {
+                const size_t index = data.randomIndex();
+                auto sample = data.getIoPair(index);
+                if (std::round(sample.second[0])) {
+                    state.outliers.push_back(index);
+                }
+                inputs.col(batch) = sample.first;
+                targets.col(batch) = sample.second;
             }
+            epochError = trainer->step(inputs, targets, state.learningRate);
+            errors.emplace_back(epoch, epochError);
+        }
+        else for (int batch = 0; batch < params.getBatchSize(); ++batch) {
+            const size_t index = data.randomIndex();
+            auto sample = data.getIoPair(index);
+            if (std::round(sample.second[0])) {
+                state.outliers.push_back(index);
+            }
+            double error = model.updateWeights(std::move(sample.first), std::move(sample.second), state.learningRate);
             epochError += error;
             errors.emplace_back(epoch, error);
         }
-        epochError /= static_cast<double>(params.getBatchSize());
-        std::cout << "Error for epoch " << epoch + 1 << ": " << epochError << '\n';
+        if (not trainer) {
+            epochError /= static_cast<double>(params.getBatchSize());
+        }
+        if (isRoot) {
+            std::cout << "Error for epoch " << epoch + 1 << ": " << epochError << '\n';
+        }
+
+        if (isRoot and params.getCheckpointInterval() and (epoch + 1) % params.getCheckpointInterval() == 0) {
+            state.epoch = epoch + 1;
+            state.rngState = data.getRngState();
+            //a failed write only loses the progress since the previous checkpoint, training goes on and the next interval tries again
+            try {
+                checkpointer.submit(model, state);
+            }
+            catch (std::exception& e) {
+                std::cerr << "Could not write a checkpoint: " << e.what() << '\n';
+            }
+        }
+    }
+
+    //replicas are identical after the last step, rank 0 finishes the run on its own
+    if (not isRoot) {
+        return 0;
     }
+    trainer.reset();
 
     auto ep = params.getEpochs();
-    for (auto& outlier : outliers) {
-        double error = model.updateWeights(std::move(outlier.first), std::move(outlier.second), params.getLearningRate());
+    for (auto index : state.outliers) {
+        auto outlier = data.getIoPair(index);
+        double error = model.updateWeights(std::move(outlier.first), std::move(outlier.second), state.learningRate);
         errors.emplace_back(++ep, error);
         std::cout << "Error for outliers: " << error << '\n';
     }
 
-    model.saveToFolder(loadingExistModel ? modelSource : fs::path(modelSource.string().substr(0, modelSource.string().find('.'))));
+    model.saveToFolder(outputDir);
+    try {
+        checkpointer.clear(); //the run is complete, a later -l starts a fresh one
+    }
+    catch (std::exception& e) {
+        std::cerr << "Could not remove checkpoints in " << checkpointDir << ": " << e.what() << '\n';
+    }
+
+    for (const pid_t child : children) {
+        int status;
+        if (::waitpid(child, &status, 0) < 0 or not WIFEXITED(status) or WEXITSTATUS(status) != 0) {
+            std::cerr << "Worker process " << child << " did not exit cleanly\n";
+        }
+    }
 
     Gnuplot gp;
 